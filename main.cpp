@@ -5,13 +5,16 @@
 
 #include <gtk/gtk.h>
 #include <webkit/webkit.h>
+#include <glib-unix.h>
 
 #include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <filesystem>
 #include <fstream>
 #include <functional>
@@ -20,23 +23,35 @@
 #include <memory>
 #include <mutex>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 // JSON (header-only nlohmann/json — instalar: apt install nlohmann-json3-dev)
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 
-// OpenSSL para PBKDF2
+// OpenSSL para PBKDF2 y AES-256-GCM
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 
+// zlib para comprimir los bloques del almacén
+#include <zlib.h>
+
 // POSIX
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <linux/keyctl.h>
 #include <netdb.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -46,19 +61,64 @@ namespace fs = std::filesystem;
 
 static std::string g_data_dir;
 static std::string g_history_file;
+static std::string g_history_journal;
 static std::string g_bookmarks_file;
+static std::string g_bookmarks_journal;
+static std::string g_search_index_file;
+static std::string g_session_file;
+static std::string g_session_journal;
+static std::string g_filter_list;
+static std::string g_filter_store_dir;
+static std::string g_hostlist_file;
+static std::string g_upgrades_file;
 static std::string g_salt_file;
+static std::string g_config_file;
 
 static void init_data_paths() {
     const char* home = getenv("HOME");
     if (!home) home = "/tmp";
     g_data_dir      = std::string(home) + "/.local/share/prektbr";
     g_history_file  = g_data_dir + "/history.json";
+    g_history_journal = g_data_dir + "/history.journal";
     g_bookmarks_file= g_data_dir + "/bookmarks.json";
+    g_bookmarks_journal = g_data_dir + "/bookmarks.journal";
+    g_search_index_file = g_data_dir + "/search.idx";
+    g_session_file  = g_data_dir + "/session.json";
+    g_session_journal = g_data_dir + "/session.journal";
+    g_filter_list   = g_data_dir + "/easylist.txt";
+    g_filter_store_dir = g_data_dir + "/filters";
+    g_hostlist_file = g_data_dir + "/hosts.bin";
+    g_upgrades_file = g_data_dir + "/upgrades.json";
     g_salt_file     = g_data_dir + "/.salt";
+    g_config_file   = g_data_dir + "/config.json";
     fs::create_directories(g_data_dir);
 }
 
+// ─── Configuración ────────────────────────────────────────────────────────────
+//
+// config.json es JSON plano (sin cifrar) editable a mano. Las claves ausentes
+// o con tipo incorrecto usan el valor por defecto de cada llamada a cfg().
+
+static json g_config = json::object();
+
+static void load_config() {
+    try {
+        std::ifstream fin(g_config_file);
+        if (!fin) return;
+        json j = json::parse(fin);
+        if (j.is_object()) g_config = j;
+    } catch (const std::exception& e) {
+        std::cerr << "[prektbr] config.json inválido: " << e.what() << "\n";
+    }
+}
+
+template <typename T>
+static T cfg(const char* key, T def) {
+    auto it = g_config.find(key);
+    if (it == g_config.end()) return def;
+    try { return it->get<T>(); } catch (...) { return def; }
+}
+
 // ─── Cifrado XOR + PBKDF2 ─────────────────────────────────────────────────────
 
 static std::vector<uint8_t> g_key;
@@ -94,7 +154,1062 @@ static std::vector<uint8_t> derive_key(int length = 64) {
     return dk;
 }
 
-static std::vector<uint8_t> xor_bytes(const std::vector<uint8_t>& data) {
+// ─── Caché de la clave en el keyring de sesión ────────────────────────────────
+//
+// Opcional (key_cache en config.json): la clave derivada se guarda como clave
+// "user" en el keyring de sesión del kernel con caducidad key_cache_timeout.
+// Las siguientes ejecuciones en la misma sesión se saltan el PBKDF2. Si no hay
+// keyring de sesión (contenedores, seccomp, kernels sin keys) se deriva como
+// siempre. La descripción incluye el uid y un resumen del salt, así que
+// regenerar .salt invalida la entrada.
+
+static long keyctl_call(int cmd, unsigned long a2, unsigned long a3 = 0,
+                        unsigned long a4 = 0, unsigned long a5 = 0) {
+    return syscall(SYS_keyctl, cmd, a2, a3, a4, a5);
+}
+
+static std::string key_cache_description() {
+    auto salt = get_or_create_salt();
+    unsigned char md[32];
+    unsigned int mdlen = 0;
+    EVP_Digest(salt.data(), salt.size(), md, &mdlen, EVP_sha256(), nullptr);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "prektbr:%u:%02x%02x%02x%02x%02x%02x%02x%02x",
+             (unsigned)getuid(), md[0], md[1], md[2], md[3], md[4], md[5], md[6], md[7]);
+    return buf;
+}
+
+static bool session_keyring_available() {
+    // create=0: no crear un keyring anónimo que moriría con el proceso
+    return keyctl_call(KEYCTL_GET_KEYRING_ID, (unsigned long)KEY_SPEC_SESSION_KEYRING, 0) >= 0;
+}
+
+static bool key_cache_load(const std::string& desc, std::vector<uint8_t>& key, size_t length) {
+    long id = keyctl_call(KEYCTL_SEARCH, (unsigned long)KEY_SPEC_SESSION_KEYRING,
+                          (unsigned long)"user", (unsigned long)desc.c_str(), 0);
+    if (id < 0) return false;
+    std::vector<uint8_t> buf(length);
+    long n = keyctl_call(KEYCTL_READ, (unsigned long)id, (unsigned long)buf.data(), buf.size());
+    if (n != (long)length) return false;
+    key = std::move(buf);
+    return true;
+}
+
+static void key_cache_store(const std::string& desc, const std::vector<uint8_t>& key, long timeout) {
+    long id = syscall(SYS_add_key, "user", desc.c_str(), key.data(), key.size(),
+                      (long)KEY_SPEC_SESSION_KEYRING);
+    if (id < 0) return;
+    // Solo el poseedor (procesos de esta sesión) puede ver/leer la clave:
+    // KEY_POS_VIEW|READ|WRITE|SEARCH|LINK|SETATTR de <keyutils.h>
+    keyctl_call(KEYCTL_SETPERM, (unsigned long)id, 0x3f000000UL);
+    if (timeout > 0) keyctl_call(KEYCTL_SET_TIMEOUT, (unsigned long)id, (unsigned long)timeout);
+}
+
+// Devuelve la clave y en *source de dónde salió, para --startup-stats.
+static std::vector<uint8_t> load_or_derive_key(std::string* source) {
+    const size_t length = 64;
+    bool use_cache = cfg("key_cache", false) && session_keyring_available();
+    std::string desc;
+    if (use_cache) {
+        desc = key_cache_description();
+        std::vector<uint8_t> key;
+        if (key_cache_load(desc, key, length)) {
+            if (source) *source = "keyring";
+            return key;
+        }
+    }
+    auto key = derive_key((int)length);
+    if (use_cache) key_cache_store(desc, key, cfg("key_cache_timeout", 3600L));
+    if (source) *source = use_cache ? "pbkdf2 (guardada en keyring)" : "pbkdf2";
+    return key;
+}
+
+// ─── Estadísticas de arranque ─────────────────────────────────────────────────
+
+struct StartupStats {
+    bool        enabled   = false;
+    bool        reported  = false;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    double      key_ms    = 0;
+    double      store_ms  = 0;
+    double      window_ms = -1;
+    double      ready_ms  = -1;
+    std::string key_source;
+
+    double since_start() const {
+        return std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t0).count();
+    }
+
+    // Se imprime una sola vez, cuando ya hay ventana y almacén
+    void report() {
+        if (!enabled || reported || window_ms < 0 || ready_ms < 0) return;
+        reported = true;
+        fprintf(stderr,
+            "[prektbr] arranque: ventana %.1f ms | clave %.1f ms (%s) | "
+            "almacén %.1f ms | datos listos %.1f ms\n",
+            window_ms, key_ms, key_source.c_str(), store_ms, ready_ms);
+    }
+};
+
+static StartupStats g_startup;
+
+// ─── XOR + Base64 vectorizados ────────────────────────────────────────────────
+//
+// Núcleos SSE2/AVX2 elegidos en tiempo de ejecución con respaldo escalar. Todo
+// trabaja sobre el búfer del llamador: el XOR es in situ y la decodificación
+// base64 también (la salida nunca adelanta a la entrada). Base64 vectorial
+// necesita pshufb, así que por debajo de AVX2 se usa la versión escalar con
+// tabla de 256 entradas en vez de buscar cada carácter.
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREKTBR_X86 1
+#endif
+
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+
+static const char* simd_level_name(SimdLevel l) {
+    switch (l) {
+        case SimdLevel::AVX2: return "avx2";
+        case SimdLevel::SSE2: return "sse2";
+        default:              return "escalar";
+    }
+}
+
+static SimdLevel detect_simd_level() {
+#ifdef PREKTBR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+static SimdLevel simd_level() {
+    static const SimdLevel lvl = detect_simd_level();
+    return lvl;
+}
+
+// Clave repetida hasta un múltiplo común de su longitud y de 32 bytes, para
+// que cada vector cargue la clave alineada con su posición en los datos.
+static std::vector<uint8_t> xor_pattern(const std::vector<uint8_t>& key) {
+    size_t a = key.size(), b = 32;
+    while (b) { size_t t = a % b; a = b; b = t; }
+    size_t plen = key.size() / a * 32;
+    std::vector<uint8_t> pat(plen);
+    for (size_t i = 0; i < plen; i++) pat[i] = key[i % key.size()];
+    return pat;
+}
+
+#ifdef PREKTBR_X86
+__attribute__((target("sse2")))
+static size_t xor_sse2(uint8_t* p, size_t n, const uint8_t* pat, size_t plen) {
+    size_t i = 0;
+    for (; i + plen <= n; i += plen) {
+        for (size_t j = 0; j < plen; j += 16) {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + j));
+            __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pat + j));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i + j), _mm_xor_si128(d, k));
+        }
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t xor_avx2(uint8_t* p, size_t n, const uint8_t* pat, size_t plen) {
+    size_t i = 0;
+    for (; i + plen <= n; i += plen) {
+        for (size_t j = 0; j < plen; j += 32) {
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + j));
+            __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pat + j));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + i + j), _mm256_xor_si256(d, k));
+        }
+    }
+    return i;
+}
+#endif
+
+static void xor_inplace_with(SimdLevel lvl, uint8_t* p, size_t n,
+                             const std::vector<uint8_t>& key) {
+    if (key.empty()) return;
+    size_t done = 0;
+#ifdef PREKTBR_X86
+    if (lvl != SimdLevel::Scalar && n >= 64) {
+        auto pat = xor_pattern(key);
+        done = (lvl == SimdLevel::AVX2) ? xor_avx2(p, n, pat.data(), pat.size())
+                                        : xor_sse2(p, n, pat.data(), pat.size());
+    }
+#else
+    (void)lvl;
+#endif
+    // Cola escalar: "done" es múltiplo de la longitud de la clave
+    size_t k = done % key.size();
+    for (size_t i = done; i < n; i++) {
+        p[i] ^= key[k];
+        if (++k == key.size()) k = 0;
+    }
+}
+
+static void xor_inplace(uint8_t* p, size_t n) {
+    xor_inplace_with(simd_level(), p, n, g_key);
+}
+
+static void xor_inplace(std::string& s) {
+    xor_inplace(reinterpret_cast<uint8_t*>(&s[0]), s.size());
+}
+
+static const char B64_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+struct B64DecodeTable {
+    uint8_t v[256];
+    B64DecodeTable() {
+        memset(v, 0xFF, sizeof(v));
+        for (int i = 0; i < 64; i++) v[(uint8_t)B64_ALPHABET[i]] = (uint8_t)i;
+    }
+};
+static const B64DecodeTable B64_DECODE;
+
+static size_t base64_encoded_len(size_t n) { return (n + 2) / 3 * 4; }
+
+static void base64_encode_scalar(const uint8_t* src, size_t n, char* dst) {
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3) {
+        uint32_t v = ((uint32_t)src[i] << 16) | ((uint32_t)src[i+1] << 8) | src[i+2];
+        *dst++ = B64_ALPHABET[(v >> 18) & 63];
+        *dst++ = B64_ALPHABET[(v >> 12) & 63];
+        *dst++ = B64_ALPHABET[(v >> 6) & 63];
+        *dst++ = B64_ALPHABET[v & 63];
+    }
+    if (i < n) {
+        uint32_t v = (uint32_t)src[i] << 16;
+        if (i + 1 < n) v |= (uint32_t)src[i+1] << 8;
+        *dst++ = B64_ALPHABET[(v >> 18) & 63];
+        *dst++ = B64_ALPHABET[(v >> 12) & 63];
+        *dst++ = (i + 1 < n) ? B64_ALPHABET[(v >> 6) & 63] : '=';
+        *dst++ = '=';
+    }
+}
+
+// Igual que la versión original: se detiene en el primer '=' o carácter
+// inválido, y un grupo final de k caracteres produce k-1 bytes.
+static size_t base64_decode_scalar(const char* src, size_t n, uint8_t* dst) {
+    uint8_t* out = dst;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uint8_t a = B64_DECODE.v[(uint8_t)src[i]],   b = B64_DECODE.v[(uint8_t)src[i+1]];
+        uint8_t c = B64_DECODE.v[(uint8_t)src[i+2]], d = B64_DECODE.v[(uint8_t)src[i+3]];
+        if ((a | b | c | d) & 0x80) break;
+        uint32_t v = ((uint32_t)a << 18) | ((uint32_t)b << 12) | ((uint32_t)c << 6) | d;
+        *out++ = (uint8_t)(v >> 16);
+        *out++ = (uint8_t)(v >> 8);
+        *out++ = (uint8_t)v;
+    }
+    uint8_t q[4] = {0, 0, 0, 0};
+    int k = 0;
+    for (; i < n && k < 4; i++) {
+        uint8_t v = B64_DECODE.v[(uint8_t)src[i]];
+        if (v & 0x80) break;
+        q[k++] = v;
+    }
+    if (k > 1) {
+        uint32_t v = ((uint32_t)q[0] << 18) | ((uint32_t)q[1] << 12) | ((uint32_t)q[2] << 6) | q[3];
+        uint8_t tail[3] = { (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+        for (int j = 0; j < k - 1; j++) *out++ = tail[j];
+    }
+    return (size_t)(out - dst);
+}
+
+#ifdef PREKTBR_X86
+// Algoritmos de W. Muła y D. Lemire ("Faster Base64 Encoding and Decoding
+// using AVX2 Instructions"): 24 bytes → 32 caracteres por iteración.
+__attribute__((target("avx2")))
+static size_t base64_encode_avx2(const uint8_t* src, size_t n, char* dst) {
+    if (n < 28) return 0;
+    const __m256i shuf = _mm256_set_epi8(
+        10, 11,  9, 10,  7,  8,  6,  7,  4,  5,  3,  4,  1,  2,  0,  1,
+        14, 15, 13, 14, 11, 12, 10, 11,  8,  9,  7,  8,  5,  6,  4,  5);
+    const __m256i lut = _mm256_setr_epi8(
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+        65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    size_t done = 0;
+    // Primera carga desde src-4 con máscara: no se leen los 4 bytes previos
+    __m256i in = _mm256_maskload_epi32(reinterpret_cast<const int*>(src - 4),
+        _mm256_set_epi32(INT32_MIN, INT32_MIN, INT32_MIN, INT32_MIN,
+                         INT32_MIN, INT32_MIN, INT32_MIN, 0));
+    for (;;) {
+        __m256i t = _mm256_shuffle_epi8(in, shuf);
+        __m256i t0 = _mm256_and_si256(t, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(t, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+        __m256i off = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        off = _mm256_sub_epi8(off, _mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)));
+        __m256i out = _mm256_add_epi8(idx, _mm256_shuffle_epi8(lut, off));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), out);
+        dst  += 32;
+        done += 24;
+        if (n - done < 32) break;
+        in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + done - 4));
+    }
+    return done;
+}
+
+// Devuelve los bytes escritos y cuántos caracteres consumió en *used. Se
+// detiene ante cualquier carácter fuera del alfabeto para que la versión
+// escalar aplique las mismas reglas de fin de datos.
+__attribute__((target("avx2")))
+static size_t base64_decode_avx2(const char* src, size_t n, uint8_t* dst, size_t* used) {
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    size_t i = 0, o = 0;
+    // 45: deja siempre el último grupo (posible relleno) a la versión escalar
+    while (n - i >= 45) {
+        __m256i str = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i hi_nib = _mm256_and_si256(_mm256_srli_epi32(str, 4), mask_2f);
+        __m256i lo_nib = _mm256_and_si256(str, mask_2f);
+        __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nib);
+        __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nib);
+        if (!_mm256_testz_si256(lo, hi)) break;
+        __m256i eq_2f = _mm256_cmpeq_epi8(str, mask_2f);
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nib));
+        str = _mm256_add_epi8(str, roll);
+        __m256i ab = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+        __m256i v  = _mm256_madd_epi16(ab, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, pack);
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+        // Escribe 32 bytes (24 útiles): in situ nunca pisa entrada sin leer
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + o), v);
+        i += 32;
+        o += 24;
+    }
+    *used = i;
+    return o;
+}
+#endif
+
+static void base64_encode_with(SimdLevel lvl, const uint8_t* src, size_t n, char* dst) {
+    size_t done = 0;
+#ifdef PREKTBR_X86
+    if (lvl == SimdLevel::AVX2) done = base64_encode_avx2(src, n, dst);
+#else
+    (void)lvl;
+#endif
+    base64_encode_scalar(src + done, n - done, dst + done / 3 * 4);
+}
+
+static size_t base64_decode_with(SimdLevel lvl, const char* src, size_t n, uint8_t* dst) {
+    size_t used = 0, o = 0;
+#ifdef PREKTBR_X86
+    if (lvl == SimdLevel::AVX2) o = base64_decode_avx2(src, n, dst, &used);
+#else
+    (void)lvl;
+#endif
+    return o + base64_decode_scalar(src + used, n - used, dst + o);
+}
+
+// Codifica "in" en "out" (reutilizado entre llamadas por quien lo posea).
+static void base64_encode(const std::string& in, std::string& out) {
+    out.resize(base64_encoded_len(in.size()));
+    base64_encode_with(simd_level(), reinterpret_cast<const uint8_t*>(in.data()),
+                       in.size(), &out[0]);
+}
+
+// Decodifica in situ; el búfer queda con el tamaño de los datos decodificados.
+static void base64_decode_inplace(std::string& buf) {
+    size_t n = base64_decode_with(simd_level(), buf.data(), buf.size(),
+                                  reinterpret_cast<uint8_t*>(&buf[0]));
+    buf.resize(n);
+}
+
+// ─── Contenedor cifrado por bloques ───────────────────────────────────────────
+//
+// Formato PKTC v1 (enteros u32 little-endian):
+//
+//   cabecera (16 B): "PKTC" | versión | tipo | códec | 0 | n_bloques | n_entradas
+//   tipo:            0 = array JSON, 1 = valor JSON, 2 = bytes opacos
+//   bloque:          n_entradas | long_plano | long_sellado | nonce | cifrado | tag
+//
+// Cada bloque guarda hasta CONTAINER_CHUNK_ENTRIES elementos del array como
+// JSON compacto comprimido con zlib y sellado con AES-256-GCM (AES-NI vía EVP).
+// La cabecera y los campos del bloque van como datos asociados, así que no se
+// pueden reordenar ni truncar bloques sin que falle la autenticación. Como los
+// bloques son independientes, leer las últimas N entradas solo descifra los
+// bloques finales.
+
+static const char     CONTAINER_MAGIC[4]      = {'P','K','T','C'};
+static const uint8_t  CONTAINER_VERSION       = 1;
+static const uint8_t  CONTAINER_KIND_ARRAY    = 0;
+static const uint8_t  CONTAINER_KIND_VALUE    = 1;
+static const uint8_t  CONTAINER_KIND_BLOB     = 2;
+static const uint8_t  CONTAINER_CODEC_ZLIB    = 1;
+static const size_t   CONTAINER_HEADER        = 16;
+static const size_t   CONTAINER_CHUNK_ENTRIES = 256;
+static const size_t   CONTAINER_BLOB_CHUNK    = 1 << 20;
+static const size_t   AEAD_NONCE              = 12;
+static const size_t   AEAD_TAG                = 16;
+
+static void put_u32(std::string& out, uint32_t v) {
+    out.push_back((char)v);
+    out.push_back((char)(v >> 8));
+    out.push_back((char)(v >> 16));
+    out.push_back((char)(v >> 24));
+}
+
+static uint32_t get_u32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Clave AES separada de la clave XOR: SHA-256(g_key || etiqueta).
+static void aead_key(uint8_t out[32]) {
+    static const char label[] = "prektbr-aead-v1";
+    std::vector<uint8_t> material(g_key);
+    material.insert(material.end(), label, label + sizeof(label) - 1);
+    EVP_Digest(material.data(), material.size(), out, nullptr, EVP_sha256(), nullptr);
+    OPENSSL_cleanse(material.data(), material.size());
+}
+
+// Añade nonce | cifrado | tag a out.
+static bool aead_seal(const std::string& aad, const uint8_t* plain, size_t n, std::string& out) {
+    uint8_t key[32];
+    aead_key(key);
+    size_t base = out.size();
+    out.resize(base + AEAD_NONCE + n + AEAD_TAG);
+    uint8_t* nonce = reinterpret_cast<uint8_t*>(&out[base]);
+    uint8_t* ct    = nonce + AEAD_NONCE;
+    bool ok = RAND_bytes(nonce, (int)AEAD_NONCE) == 1;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int len = 0;
+    ok = ok && ctx
+        && EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, nonce) == 1
+        && EVP_EncryptUpdate(ctx, nullptr, &len,
+                             reinterpret_cast<const uint8_t*>(aad.data()), (int)aad.size()) == 1
+        && EVP_EncryptUpdate(ctx, ct, &len, plain, (int)n) == 1
+        && EVP_EncryptFinal_ex(ctx, ct + len, &len) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, (int)AEAD_TAG, ct + n) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!ok) out.resize(base);
+    return ok;
+}
+
+// Abre nonce | cifrado | tag; falla si el tag no verifica.
+static bool aead_open(const std::string& aad, const uint8_t* sealed, size_t n, std::string& out) {
+    if (n < AEAD_NONCE + AEAD_TAG) return false;
+    uint8_t key[32];
+    aead_key(key);
+    size_t ct_len = n - AEAD_NONCE - AEAD_TAG;
+    out.resize(ct_len);
+    uint8_t* pt = reinterpret_cast<uint8_t*>(&out[0]);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    int len = 0;
+    bool ok = ctx
+        && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), nullptr, key, sealed) == 1
+        && EVP_DecryptUpdate(ctx, nullptr, &len,
+                             reinterpret_cast<const uint8_t*>(aad.data()), (int)aad.size()) == 1
+        && EVP_DecryptUpdate(ctx, pt, &len, sealed + AEAD_NONCE, (int)ct_len) == 1
+        && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, (int)AEAD_TAG,
+                               const_cast<uint8_t*>(sealed + n - AEAD_TAG)) == 1
+        && EVP_DecryptFinal_ex(ctx, pt + len, &len) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!ok) out.clear();
+    return ok;
+}
+
+static std::string container_chunk_aad(const uint8_t* header, uint32_t index,
+                                       uint32_t entries, uint32_t plain_len) {
+    std::string aad(reinterpret_cast<const char*>(header), CONTAINER_HEADER);
+    put_u32(aad, index);
+    put_u32(aad, entries);
+    put_u32(aad, plain_len);
+    return aad;
+}
+
+static void container_header(uint8_t kind, size_t chunks, size_t total, std::string& out) {
+    out.clear();
+    out.append(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    out.push_back((char)CONTAINER_VERSION);
+    out.push_back((char)kind);
+    out.push_back((char)CONTAINER_CODEC_ZLIB);
+    out.push_back('\0');
+    put_u32(out, (uint32_t)chunks);
+    put_u32(out, (uint32_t)total);
+}
+
+// Comprime, sella y añade el bloque c; out debe empezar por la cabecera.
+static bool container_seal_chunk(std::string& out, size_t c, size_t count,
+                                 const std::string& plain, std::string& packed,
+                                 int level = Z_DEFAULT_COMPRESSION) {
+    uLongf packed_len = compressBound((uLong)plain.size());
+    packed.resize(packed_len);
+    if (compress2(reinterpret_cast<Bytef*>(&packed[0]), &packed_len,
+                  reinterpret_cast<const Bytef*>(plain.data()), (uLong)plain.size(),
+                  level) != Z_OK)
+        return false;
+    std::string aad = container_chunk_aad(reinterpret_cast<const uint8_t*>(out.data()),
+                                          (uint32_t)c, (uint32_t)count, (uint32_t)plain.size());
+    put_u32(out, (uint32_t)count);
+    put_u32(out, (uint32_t)plain.size());
+    put_u32(out, (uint32_t)(packed_len + AEAD_NONCE + AEAD_TAG));
+    return aead_seal(aad, reinterpret_cast<const uint8_t*>(packed.data()), packed_len, out);
+}
+
+static bool container_encode(const json& data, std::string& out) {
+    bool is_array = data.is_array();
+    size_t total = is_array ? data.size() : 1;
+    size_t chunks = is_array ? (total + CONTAINER_CHUNK_ENTRIES - 1) / CONTAINER_CHUNK_ENTRIES : 1;
+    container_header(is_array ? CONTAINER_KIND_ARRAY : CONTAINER_KIND_VALUE, chunks, total, out);
+
+    std::string plain, packed;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t first = c * CONTAINER_CHUNK_ENTRIES;
+        size_t count = is_array ? std::min(CONTAINER_CHUNK_ENTRIES, total - first) : 1;
+        if (is_array) {
+            plain = "[";
+            for (size_t i = 0; i < count; i++) {
+                if (i) plain += ',';
+                plain += data[first + i].dump();
+            }
+            plain += ']';
+        } else {
+            plain = data.dump();
+        }
+        if (!container_seal_chunk(out, c, count, plain, packed)) return false;
+    }
+    return true;
+}
+
+// Bytes opacos (índices binarios): bloques de CONTAINER_BLOB_CHUNK bytes, cuyo
+// campo n_entradas es la longitud del bloque. Son datos reconstruibles, así
+// que se prima la velocidad de compresión.
+static bool container_encode_blob(const std::string& bytes, std::string& out) {
+    size_t chunks = (bytes.size() + CONTAINER_BLOB_CHUNK - 1) / CONTAINER_BLOB_CHUNK;
+    container_header(CONTAINER_KIND_BLOB, chunks, bytes.size(), out);
+    std::string plain, packed;
+    for (size_t c = 0; c < chunks; c++) {
+        plain.assign(bytes, c * CONTAINER_BLOB_CHUNK, CONTAINER_BLOB_CHUNK);
+        if (!container_seal_chunk(out, c, plain.size(), plain, packed, Z_BEST_SPEED)) return false;
+    }
+    return true;
+}
+
+static bool is_container(const std::string& buf) {
+    return buf.size() >= CONTAINER_HEADER && memcmp(buf.data(), CONTAINER_MAGIC, 4) == 0;
+}
+
+struct ContainerChunk { uint32_t entries, plain_len, sealed_len; const uint8_t* sealed; bool sane; };
+
+// Límite de plain_len antes de autenticarlo: zlib no comprime más de ~1032:1,
+// así que un valor mayor solo puede venir de un campo dañado. Sin él, un byte
+// alterado pediría hasta 4 GiB antes de que AEAD rechazara el bloque.
+static const size_t CONTAINER_MAX_PLAIN = 256u << 20;
+
+static bool container_plain_len_ok(uint32_t plain_len, uint32_t sealed_len) {
+    return plain_len <= CONTAINER_MAX_PLAIN && plain_len <= (uint64_t)sealed_len * 1040 + 64;
+}
+
+// Valida la cabecera y recorre la tabla de bloques sin descifrar nada.
+static bool container_table(const std::string& buf, uint8_t& kind, std::vector<ContainerChunk>& table) {
+    const uint8_t* p   = reinterpret_cast<const uint8_t*>(buf.data());
+    const uint8_t* end = p + buf.size();
+    if (!is_container(buf) || p[4] != CONTAINER_VERSION || p[6] != CONTAINER_CODEC_ZLIB)
+        return false;
+    kind = p[5];
+    if (kind != CONTAINER_KIND_ARRAY && kind != CONTAINER_KIND_VALUE && kind != CONTAINER_KIND_BLOB)
+        return false;
+    uint32_t chunks = get_u32(p + 8);
+    table.clear();
+    table.reserve(std::min<uint32_t>(chunks, 1u << 16));
+    const uint8_t* q = p + CONTAINER_HEADER;
+    for (uint32_t c = 0; c < chunks; c++) {
+        if (end - q < 12) return false;
+        ContainerChunk ch{get_u32(q), get_u32(q + 4), get_u32(q + 8), q + 12, false};
+        if ((size_t)(end - ch.sealed) < ch.sealed_len) return false;
+        ch.sane = container_plain_len_ok(ch.plain_len, ch.sealed_len); // si no, se omite al abrirlo
+        table.push_back(ch);
+        q = ch.sealed + ch.sealed_len;
+    }
+    return true;
+}
+
+static bool container_open_chunk(const std::string& buf, const ContainerChunk& ch, size_t c,
+                                 std::string& packed, std::string& plain) {
+    std::string aad = container_chunk_aad(reinterpret_cast<const uint8_t*>(buf.data()),
+                                          (uint32_t)c, ch.entries, ch.plain_len);
+    if (!ch.sane || !aead_open(aad, ch.sealed, ch.sealed_len, packed)) return false;
+    uLongf plain_len = ch.plain_len;
+    plain.resize(plain_len);
+    return uncompress(reinterpret_cast<Bytef*>(&plain[0]), &plain_len,
+                      reinterpret_cast<const Bytef*>(packed.data()), (uLong)packed.size()) == Z_OK
+        && plain_len == ch.plain_len;
+}
+
+// Descifra el contenedor. Con tail > 0 (solo arrays) se saltan los bloques
+// que no contienen ninguna de las últimas `tail` entradas. Un bloque dañado se
+// descarta con aviso y se conservan los demás.
+static bool container_decode(const std::string& buf, json& out, size_t tail = 0) {
+    uint8_t kind;
+    std::vector<ContainerChunk> table;
+    if (!container_table(buf, kind, table) || kind == CONTAINER_KIND_BLOB) return false;
+    bool is_array = kind == CONTAINER_KIND_ARRAY;
+
+    size_t first = 0;
+    if (is_array && tail > 0) {
+        size_t have = 0;
+        first = table.size();
+        while (first > 0 && have < tail) have += table[--first].entries;
+    }
+
+    out = is_array ? json::array() : json();
+    std::string packed, plain;
+    for (size_t c = first; c < table.size(); c++) {
+        if (!container_open_chunk(buf, table[c], c, packed, plain)) {
+            std::cerr << "[prektbr] Bloque " << c << " dañado, se omite\n";
+            if (!is_array) return false;
+            continue;
+        }
+        if (!is_array) {
+            out = json::parse(plain);
+            return true;
+        }
+        json part = json::parse(plain);
+        for (auto& e : part) out.push_back(std::move(e));
+    }
+    if (is_array && tail > 0 && out.size() > tail)
+        out.erase(out.begin(), out.end() - (std::ptrdiff_t)tail);
+    return true;
+}
+
+// En un blob no tiene sentido omitir bloques: cualquier fallo invalida todo.
+static bool container_decode_blob(const std::string& buf, std::string& out) {
+    uint8_t kind;
+    std::vector<ContainerChunk> table;
+    if (!container_table(buf, kind, table) || kind != CONTAINER_KIND_BLOB) return false;
+    out.clear();
+    std::string packed, plain;
+    for (size_t c = 0; c < table.size(); c++) {
+        if (!container_open_chunk(buf, table[c], c, packed, plain)) return false;
+        out += plain;
+    }
+    return true;
+}
+
+// ─── Carga / guardado JSON cifrado ────────────────────────────────────────────
+
+static bool read_file(const std::string& path, std::string& buf) {
+    std::ifstream fin(path, std::ios::binary | std::ios::ate);
+    if (!fin) return false;
+    std::streamsize size = fin.tellg();
+    if (size < 0) return false;
+    buf.resize((size_t)size);
+    fin.seekg(0);
+    return (bool)fin.read(&buf[0], size);
+}
+
+// Definida tras PersistWorker: reescribe en segundo plano un archivo antiguo.
+static void migrate_legacy_file(const std::string& path, const json& data);
+
+// Lee el contenedor PKTC (con tail > 0 solo las últimas entradas). Los formatos
+// anteriores, base64(XOR(JSON)) o JSON plano, se leen igual y se migran al
+// contenedor en cuanto se cargan.
+static json load_json_file(const std::string& path, const json& defval, size_t tail = 0) {
+    try {
+        std::string buf;
+        if (!read_file(path, buf)) return defval;
+        if (is_container(buf)) {
+            json out;
+            return container_decode(buf, out, tail) ? out : defval;
+        }
+        // Fallback: JSON plano ('[' o '{' no pertenecen al alfabeto base64)
+        if (!buf.empty() && !(B64_DECODE.v[(uint8_t)buf[0]] & 0x80)) {
+            base64_decode_inplace(buf);
+            xor_inplace(buf);
+        }
+        json legacy = json::parse(buf);
+        migrate_legacy_file(path, legacy);
+        return legacy;
+    } catch (...) {
+        return defval;
+    }
+}
+
+// Escribe en <path>.tmp, fsync, rename y fsync del directorio: un corte de
+// luz deja el archivo viejo o el nuevo, nunca uno a medias.
+static bool write_file_atomic(const std::string& path, const std::string& bytes) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return false;
+    size_t off = 0;
+    while (off < bytes.size()) {
+        ssize_t n = write(fd, bytes.data() + off, bytes.size() - off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        off += (size_t)n;
+    }
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    std::string dir = fs::path(path).parent_path().string();
+    int dfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return true;
+}
+
+static void save_json_file(const std::string& path, const json& data) {
+    try {
+        // Búfer de salida reutilizado entre guardados del mismo hilo
+        thread_local std::string sealed;
+        if (!container_encode(data, sealed)) {
+            std::cerr << "[prektbr] Error cifrando " << path << "\n";
+            return;
+        }
+        if (!write_file_atomic(path, sealed))
+            std::cerr << "[prektbr] Error guardando " << path << ": " << strerror(errno) << "\n";
+    } catch (const std::exception& e) {
+        std::cerr << "[prektbr] Error guardando " << path << ": " << e.what() << "\n";
+    }
+}
+
+static bool load_blob_file(const std::string& path, std::string& out) {
+    std::string buf;
+    return read_file(path, buf) && container_decode_blob(buf, out);
+}
+
+static void save_blob_file(const std::string& path, const std::string& bytes) {
+    thread_local std::string sealed;
+    if (!container_encode_blob(bytes, sealed)) {
+        std::cerr << "[prektbr] Error cifrando " << path << "\n";
+        return;
+    }
+    if (!write_file_atomic(path, sealed))
+        std::cerr << "[prektbr] Error guardando " << path << ": " << strerror(errno) << "\n";
+}
+
+// ─── Diario append-only ───────────────────────────────────────────────────────
+//
+// Formato: "PKJ3" + identificador aleatorio de 8 bytes, seguido de registros
+// [u32 longitud LE][nonce | cifrado | tag], cada uno un JSON compacto sellado
+// con AES-256-GCM. Los datos asociados son cabecera | nombre del archivo |
+// número de registro, así que un registro no puede reordenarse, saltarse ni
+// copiarse a otro diario (o a una generación anterior del mismo: cada
+// compactación crea un identificador nuevo). Añadir una visita cuesta una
+// escritura pequeña en vez de reescribir todo. Un registro truncado o que no
+// autentica detiene la lectura. Los diarios "PKJ1" (JSON ⊕ clave) todavía se
+// leen; el primer registro nuevo los sustituye.
+
+static const char JOURNAL_MAGIC[4]    = {'P','K','J','3'};
+static const char JOURNAL_MAGIC_V1[4] = {'P','K','J','1'};
+static const size_t JOURNAL_HEADER    = 4 + 8;
+
+// Posición de escritura de un diario: cabecera, siguiente número de registro
+// y final del último registro válido.
+struct JournalCursor {
+    std::string header;
+    uint64_t    next = 0;
+    off_t       end  = 0;
+};
+
+static std::string journal_aad(const std::string& path, const std::string& header, uint64_t seq) {
+    std::string aad = header;
+    aad += fs::path(path).filename().string();
+    aad.push_back('\0');
+    put_u32(aad, (uint32_t)seq);
+    put_u32(aad, (uint32_t)(seq >> 32));
+    return aad;
+}
+
+static std::string journal_encode(const std::string& path, JournalCursor& cur, const json& record) {
+    std::string s = record.dump();
+    std::string out;
+    out.reserve(4 + AEAD_NONCE + s.size() + AEAD_TAG);
+    put_u32(out, (uint32_t)(AEAD_NONCE + s.size() + AEAD_TAG));
+    if (!aead_seal(journal_aad(path, cur.header, cur.next), reinterpret_cast<const uint8_t*>(s.data()),
+                   s.size(), out))
+        return std::string();
+    cur.next++;
+    return out;
+}
+
+// Lee los registros que autentican, en orden, y deja cur al final del último.
+// Un archivo inexistente o de formato desconocido deja cur.header vacío.
+static std::vector<json> journal_read(const std::string& path, JournalCursor& cur) {
+    std::vector<json> out;
+    cur = JournalCursor();
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin) return out;
+    char header[JOURNAL_HEADER];
+    if (!fin.read(header, 4)) return out;
+    bool v1 = memcmp(header, JOURNAL_MAGIC_V1, 4) == 0;
+    if (!v1) {
+        if (memcmp(header, JOURNAL_MAGIC, 4) != 0 || !fin.read(header + 4, 8)) return out;
+        cur.header.assign(header, JOURNAL_HEADER);
+        cur.end = JOURNAL_HEADER;
+    }
+    uint8_t hdr[4];
+    std::string rec, plain;
+    while (fin.read(reinterpret_cast<char*>(hdr), 4)) {
+        uint32_t len = get_u32(hdr);
+        if (len == 0 || len > (16u << 20)) break;
+        rec.resize(len);
+        if (!fin.read(&rec[0], len)) break;
+        if (v1) {
+            xor_inplace(rec);
+            plain.swap(rec);
+        } else if (!aead_open(journal_aad(path, cur.header, cur.next),
+                              reinterpret_cast<const uint8_t*>(rec.data()), rec.size(), plain)) {
+            break;
+        }
+        try {
+            out.push_back(json::parse(plain));
+        } catch (...) {
+            break;
+        }
+        if (!v1) {
+            cur.next++;
+            cur.end += 4 + len;
+        }
+    }
+    return out;
+}
+
+static std::vector<json> journal_replay(const std::string& path) {
+    JournalCursor cur;
+    return journal_read(path, cur);
+}
+
+// Añade registros al diario. Si cur aún no es válido se lee el archivo para
+// continuar la numeración; un archivo ausente, de la versión anterior o con
+// un final que no autentica se reinicia o se recorta hasta el último
+// registro válido, para que lo nuevo no quede detrás de basura ilegible.
+static void journal_write(const std::string& path, JournalCursor& cur, bool& cur_valid,
+                          const std::vector<json>& records) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        std::cerr << "[prektbr] Error escribiendo diario " << path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    std::string buf;
+    if (!cur_valid) {
+        journal_read(path, cur);
+        if (cur.header.empty()) {
+            cur.header.assign(JOURNAL_MAGIC, 4);
+            cur.header.resize(JOURNAL_HEADER);
+            if (RAND_bytes(reinterpret_cast<uint8_t*>(&cur.header[4]), 8) != 1) { close(fd); return; }
+            cur.next = 0;
+            cur.end  = 0;
+            buf = cur.header;
+        }
+        if (ftruncate(fd, cur.end) != 0) { close(fd); return; }
+        cur_valid = true;
+    }
+    for (auto& r : records) {
+        try { buf += journal_encode(path, cur, r); } catch (...) {}
+    }
+    size_t off = 0;
+    while (off < buf.size()) {
+        ssize_t n = pwrite(fd, buf.data() + off, buf.size() - off, cur.end + (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "[prektbr] Error escribiendo diario " << path << ": " << strerror(errno) << "\n";
+            cur_valid = false;
+            break;
+        }
+        off += (size_t)n;
+    }
+    cur.end += (off_t)off;
+    fdatasync(fd);
+    close(fd);
+}
+
+static void journal_reset(const std::string& path) {
+    std::error_code ec;
+    fs::remove(path, ec);
+}
+
+// ─── Persistencia en segundo plano ────────────────────────────────────────────
+//
+// Los manejadores GTK solo encolan copias inmutables (snapshots) o registros
+// de diario; el hilo de persistencia serializa, cifra y escribe. Las ráfagas
+// dentro de la ventana de agrupación se combinan: de varios snapshots del mismo
+// archivo solo se escribe el último, y los registros de diario se añaden con
+// una sola escritura + fdatasync.
+
+class PersistWorker {
+public:
+    void start(int window_ms) {
+        window_ = std::chrono::milliseconds(std::max(0, window_ms));
+        thread_ = std::thread([this]{ run(); });
+    }
+
+    // Reemplaza cualquier snapshot pendiente del mismo archivo.
+    void save_snapshot(const std::string& path, json data) {
+        std::lock_guard<std::mutex> lk(mu_);
+        drop_pending(Op::Snapshot, path);
+        ops_.push_back({Op::Snapshot, path, std::move(data), "", ""});
+        cv_.notify_all();
+    }
+
+    // Igual que save_snapshot, para bytes ya serializados (índices).
+    void save_blob(const std::string& path, std::string bytes) {
+        std::lock_guard<std::mutex> lk(mu_);
+        drop_pending(Op::Blob, path);
+        ops_.push_back({Op::Blob, path, json(), "", std::move(bytes)});
+        cv_.notify_all();
+    }
+
+    void append_journal(const std::string& path, json record) {
+        std::lock_guard<std::mutex> lk(mu_);
+        ops_.push_back({Op::Append, path, std::move(record), "", ""});
+        cv_.notify_all();
+    }
+
+    // Snapshot completo + borrado del diario: los registros pendientes de ese
+    // diario ya están incluidos en el snapshot y se descartan.
+    void compact(const std::string& path, json data, const std::string& journal) {
+        std::lock_guard<std::mutex> lk(mu_);
+        drop_pending(Op::Snapshot, path);
+        drop_pending(Op::Append, journal);
+        drop_pending(Op::Compact, path);
+        ops_.push_back({Op::Compact, path, std::move(data), journal, ""});
+        cv_.notify_all();
+    }
+
+    // Escribe todo lo pendiente sin esperar la ventana de agrupación.
+    void flush() {
+        std::unique_lock<std::mutex> lk(mu_);
+        urgent_ = true;
+        cv_.notify_all();
+        idle_cv_.wait(lk, [this]{ return ops_.empty() && !busy_; });
+        urgent_ = false;
+    }
+
+    void stop() {
+        if (!thread_.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            stopping_ = true;
+            cv_.notify_all();
+        }
+        thread_.join();
+    }
+
+private:
+    struct Op {
+        enum Kind { Snapshot, Append, Compact, Blob } kind;
+        std::string path;
+        json        data;
+        std::string journal;
+        std::string bytes;
+    };
+
+    void drop_pending(Op::Kind kind, const std::string& path) {
+        ops_.erase(std::remove_if(ops_.begin(), ops_.end(),
+            [&](const Op& o){ return o.kind == kind && o.path == path; }), ops_.end());
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mu_);
+        for (;;) {
+            cv_.wait(lk, [this]{ return stopping_ || !ops_.empty(); });
+            if (ops_.empty() && stopping_) break;
+            // Ventana de agrupación: esperar más cambios salvo quit/flush
+            cv_.wait_for(lk, window_, [this]{ return stopping_ || urgent_; });
+            std::deque<Op> batch;
+            batch.swap(ops_);
+            busy_ = true;
+            lk.unlock();
+            process(batch);
+            lk.lock();
+            busy_ = false;
+            if (ops_.empty()) idle_cv_.notify_all();
+        }
+        idle_cv_.notify_all();
+    }
+
+    void process(std::deque<Op>& batch) {
+        // Registros de diario consecutivos del mismo archivo → una escritura
+        std::string pending_path;
+        std::vector<json> pending;
+        auto flush_appends = [&]{
+            if (!pending.empty()) {
+                auto& c = cursors_[pending_path];
+                journal_write(pending_path, c.cursor, c.valid, pending);
+            }
+            pending.clear();
+        };
+        for (auto& op : batch) {
+            if (op.kind == Op::Append) {
+                if (op.path != pending_path) { flush_appends(); pending_path = op.path; }
+                pending.push_back(std::move(op.data));
+                continue;
+            }
+            flush_appends();
+            if (op.kind == Op::Blob) {
+                save_blob_file(op.path, op.bytes);
+                continue;
+            }
+            save_json_file(op.path, op.data);
+            if (op.kind == Op::Compact) {
+                journal_reset(op.journal);
+                cursors_.erase(op.journal);
+            }
+        }
+        flush_appends();
+    }
+
+    // Solo los usa el hilo de persistencia
+    struct Cursor { JournalCursor cursor; bool valid = false; };
+    std::map<std::string, Cursor> cursors_;
+
+    std::mutex                mu_;
+    std::condition_variable   cv_;
+    std::condition_variable   idle_cv_;
+    std::deque<Op>            ops_;
+    std::thread               thread_;
+    std::chrono::milliseconds window_{250};
+    bool                      stopping_ = false;
+    bool                      urgent_   = false;
+    bool                      busy_     = false;
+};
+
+static PersistWorker g_persist;
+
+static void migrate_legacy_file(const std::string& path, const json& data) {
+    std::cerr << "[prektbr] Migrando " << path << " al formato PKTC\n";
+    g_persist.save_snapshot(path, data);
+}
+
+// ─── Benchmark del códec del almacén ──────────────────────────────────────────
+//
+// prektbr --bench-codec compara las funciones originales (copiadas aquí sin
+// cambios) con los núcleos actuales en cada nivel SIMD disponible, sobre
+// cargas de 1 MB a 64 MB con aspecto de historial. También verifica que los
+// resultados sean idénticos byte a byte.
+
+static std::vector<uint8_t> legacy_xor_bytes(const std::vector<uint8_t>& data) {
     std::vector<uint8_t> result(data.size());
     for (size_t i = 0; i < data.size(); i++) {
         result[i] = data[i] ^ g_key[i % g_key.size()];
@@ -102,12 +1217,10 @@ static std::vector<uint8_t> xor_bytes(const std::vector<uint8_t>& data) {
     return result;
 }
 
-// ─── Base64 simple ────────────────────────────────────────────────────────────
-
-static const std::string B64_CHARS =
+static const std::string LEGACY_B64_CHARS =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-static std::string base64_encode(const std::vector<uint8_t>& data) {
+static std::string legacy_base64_encode(const std::vector<uint8_t>& data) {
     std::string out;
     int i = 0, j = 0;
     uint8_t buf3[3], buf4[4];
@@ -121,13 +1234,13 @@ static std::string base64_encode(const std::vector<uint8_t>& data) {
         buf4[1] = ((buf3[0] & 0x03) << 4) + ((buf3[1] & 0xf0) >> 4);
         buf4[2] = ((buf3[1] & 0x0f) << 2) + ((buf3[2] & 0xc0) >> 6);
         buf4[3] = buf3[2] & 0x3f;
-        for (j = 0; j < i + 1; j++) out += B64_CHARS[buf4[j]];
+        for (j = 0; j < i + 1; j++) out += LEGACY_B64_CHARS[buf4[j]];
         while (i++ < 3) out += '=';
     }
     return out;
 }
 
-static std::vector<uint8_t> base64_decode(const std::string& s) {
+static std::vector<uint8_t> legacy_base64_decode(const std::string& s) {
     std::vector<uint8_t> out;
     int i = 0, j = 0;
     uint8_t buf4[4], buf3[3];
@@ -138,7 +1251,7 @@ static std::vector<uint8_t> base64_decode(const std::string& s) {
     while (pos < s.size() && s[pos] != '=' && is_b64((uint8_t)s[pos])) {
         buf4[i++] = (uint8_t)s[pos++];
         if (i == 4) {
-            for (int k = 0; k < 4; k++) buf4[k] = (uint8_t)B64_CHARS.find(buf4[k]);
+            for (int k = 0; k < 4; k++) buf4[k] = (uint8_t)LEGACY_B64_CHARS.find(buf4[k]);
             buf3[0] = (buf4[0] << 2) + ((buf4[1] & 0x30) >> 4);
             buf3[1] = ((buf4[1] & 0xf) << 4) + ((buf4[2] & 0x3c) >> 2);
             buf3[2] = ((buf4[2] & 0x3) << 6) + buf4[3];
@@ -148,7 +1261,7 @@ static std::vector<uint8_t> base64_decode(const std::string& s) {
     }
     if (i) {
         for (j = i; j < 4; j++) buf4[j] = 0;
-        for (j = 0; j < 4; j++) buf4[j] = (uint8_t)B64_CHARS.find(buf4[j]);
+        for (j = 0; j < 4; j++) buf4[j] = (uint8_t)LEGACY_B64_CHARS.find(buf4[j]);
         buf3[0] = (buf4[0] << 2) + ((buf4[1] & 0x30) >> 4);
         buf3[1] = ((buf4[1] & 0xf) << 4) + ((buf4[2] & 0x3c) >> 2);
         buf3[2] = ((buf4[2] & 0x3) << 6) + buf4[3];
@@ -157,37 +1270,64 @@ static std::vector<uint8_t> base64_decode(const std::string& s) {
     return out;
 }
 
-// ─── Carga / guardado JSON cifrado ────────────────────────────────────────────
+static int run_codec_benchmark() {
+    g_key.resize(64);
+    RAND_bytes(g_key.data(), (int)g_key.size());
 
-static json load_json_file(const std::string& path, const json& defval) {
-    try {
-        std::ifstream fin(path, std::ios::binary);
-        if (!fin) return defval;
-        std::vector<uint8_t> raw((std::istreambuf_iterator<char>(fin)),
-                                  std::istreambuf_iterator<char>());
-        // Intentar descifrado XOR+base64
-        try {
-            auto decoded = base64_decode(std::string(raw.begin(), raw.end()));
-            auto plain   = xor_bytes(decoded);
-            return json::parse(std::string(plain.begin(), plain.end()));
-        } catch (...) {}
-        // Fallback: JSON plano
-        return json::parse(std::string(raw.begin(), raw.end()));
-    } catch (...) {
-        return defval;
-    }
-}
-
-static void save_json_file(const std::string& path, const json& data) {
-    try {
-        std::string s = data.dump(2);
-        std::vector<uint8_t> raw(s.begin(), s.end());
-        auto encrypted = base64_encode(xor_bytes(raw));
-        std::ofstream fout(path, std::ios::binary);
-        fout.write(encrypted.data(), encrypted.size());
-    } catch (const std::exception& e) {
-        std::cerr << "[prektbr] Error guardando " << path << ": " << e.what() << "\n";
+    std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (simd_level() != SimdLevel::Scalar) levels.push_back(SimdLevel::SSE2);
+    if (simd_level() == SimdLevel::AVX2)   levels.push_back(SimdLevel::AVX2);
+
+    using clk = std::chrono::steady_clock;
+    auto mbps = [](size_t bytes, clk::duration d) {
+        double s = std::chrono::duration<double>(d).count();
+        return s > 0 ? bytes / s / (1024.0 * 1024.0) : 0.0;
+    };
+
+    printf("CPU: %s\n", simd_level_name(simd_level()));
+    printf("%-6s %-9s %12s %12s\n", "MB", "impl", "guardar MB/s", "cargar MB/s");
+    for (size_t mb : {1, 4, 16, 64}) {
+        // Texto parecido a history.json para que el base64 vea datos reales
+        std::string plain;
+        plain.reserve(mb << 20);
+        for (int i = 0; plain.size() < (mb << 20); i++) {
+            plain += "  {\n    \"title\": \"Página " + std::to_string(i) +
+                     "\",\n    \"ts\": \"2024-01-01T00:00:00\",\n    \"url\": \"https://example.com/" +
+                     std::to_string(i * 7919) + "\"\n  },\n";
+        }
+        plain.resize(mb << 20);
+
+        auto t0 = clk::now();
+        std::string ref_enc = legacy_base64_encode(legacy_xor_bytes(
+            std::vector<uint8_t>(plain.begin(), plain.end())));
+        auto t1 = clk::now();
+        auto ref_dec = legacy_xor_bytes(legacy_base64_decode(ref_enc));
+        auto t2 = clk::now();
+        printf("%-6zu %-9s %12.1f %12.1f\n", mb, "original", mbps(plain.size(), t1 - t0),
+               mbps(plain.size(), t2 - t1));
+
+        std::string enc, buf;
+        for (SimdLevel lvl : levels) {
+            auto a = clk::now();
+            buf = plain;
+            xor_inplace_with(lvl, reinterpret_cast<uint8_t*>(&buf[0]), buf.size(), g_key);
+            enc.resize(base64_encoded_len(buf.size()));
+            base64_encode_with(lvl, reinterpret_cast<const uint8_t*>(buf.data()), buf.size(), &enc[0]);
+            auto b = clk::now();
+            buf = enc;
+            auto c = clk::now();
+            size_t n = base64_decode_with(lvl, buf.data(), buf.size(), reinterpret_cast<uint8_t*>(&buf[0]));
+            buf.resize(n);
+            xor_inplace_with(lvl, reinterpret_cast<uint8_t*>(&buf[0]), buf.size(), g_key);
+            auto d = clk::now();
+            bool ok = enc == ref_enc && buf == plain;
+            printf("%-6zu %-9s %12.1f %12.1f%s\n", mb, simd_level_name(lvl),
+                   mbps(plain.size(), b - a), mbps(plain.size(), d - c),
+                   ok ? "" : "  ¡DIFIERE!");
+            if (!ok) return 1;
+        }
     }
+    return 0;
 }
 
 // ─── CSS global ───────────────────────────────────────────────────────────────
@@ -215,6 +1355,24 @@ static const char* GLOBAL_CSS = R"css(
     background-color: #1e1e2e;
 }
 
+/* Sugerencias de la barra de direcciones */
+.suggest-popover contents {
+    background-color: #1e1e2e;
+    border: 1px solid #45475a;
+    padding: 2px;
+}
+.suggest-row {
+    padding: 4px 8px;
+}
+.suggest-title {
+    color: #cdd6f4;
+    font-size: 13px;
+}
+.suggest-url {
+    color: #89b4fa;
+    font-size: 11px;
+}
+
 /* Botones de navegación */
 .nav-button {
     background-color: transparent;
@@ -272,6 +1430,10 @@ static const char* GLOBAL_CSS = R"css(
 }
 
 /* Pestaña activa */
+.tab-discarded {
+    opacity: 0.6;
+    font-style: italic;
+}
 .tab-active {
     background-color: #1e1e2e;
     color: #cdd6f4;
@@ -468,6 +1630,16 @@ static const char* GLOBAL_CSS = R"css(
 .sidebar-item:hover {
     background-color: #313244;
 }
+.sidebar-search {
+    margin: 6px 6px 0 6px;
+    font-size: 12px;
+}
+.sidebar-section {
+    color: #89b4fa;
+    font-size: 11px;
+    font-weight: bold;
+    padding: 8px 10px 2px 10px;
+}
 .close-tab-btn {
     background-color: transparent;
     color: #6c7086;
@@ -674,115 +1846,1302 @@ static const char* FP_PROTECTION_JS = R"js(
         });
     }
 
-    // 9. TIMEZONE
-    Date.prototype.getTimezoneOffset = function() { return 0; };
-    try {
-        const origDTF = Intl.DateTimeFormat;
-        Intl.DateTimeFormat = function(locale, opts = {}) {
-            opts.timeZone = 'UTC';
-            return new origDTF(locale, opts);
-        };
-        Object.assign(Intl.DateTimeFormat, origDTF);
-        Intl.DateTimeFormat.prototype = origDTF.prototype;
-    } catch(e) {}
+    // 9. TIMEZONE
+    Date.prototype.getTimezoneOffset = function() { return 0; };
+    try {
+        const origDTF = Intl.DateTimeFormat;
+        Intl.DateTimeFormat = function(locale, opts = {}) {
+            opts.timeZone = 'UTC';
+            return new origDTF(locale, opts);
+        };
+        Object.assign(Intl.DateTimeFormat, origDTF);
+        Intl.DateTimeFormat.prototype = origDTF.prototype;
+    } catch(e) {}
+
+    // 10. FUENTES
+    if (document.fonts && document.fonts.check) {
+        const generic = ['serif','sans-serif','monospace','cursive','fantasy','system-ui'];
+        const origCheck = document.fonts.check.bind(document.fonts);
+        document.fonts.check = (font, txt) =>
+            generic.some(g => font.toLowerCase().includes(g)) ? origCheck(font, txt) : false;
+        const origLoad = document.fonts.load.bind(document.fonts);
+        document.fonts.load = (font, txt) =>
+            generic.some(g => font.toLowerCase().includes(g)) ? origLoad(font, txt) : Promise.resolve([]);
+    }
+
+    // 11. WINDOW.NAME
+    window.name = '';
+
+    // 12. NETWORK INFORMATION API
+    try {
+        Object.defineProperty(navigator, 'onLine', { get: () => true, configurable: true });
+    } catch(e) {}
+
+    // 13. GEOLOCATION
+    if (navigator.geolocation) {
+        navigator.geolocation.getCurrentPosition = (ok, err) => {
+            if (err) err({ code: 1, message: 'Permission denied' });
+        };
+        navigator.geolocation.watchPosition = (ok, err) => {
+            if (err) err({ code: 1, message: 'Permission denied' });
+            return 0;
+        };
+    }
+
+    // 14. MEDIA DEVICES
+    if (navigator.mediaDevices) {
+        navigator.mediaDevices.enumerateDevices = () => Promise.resolve([]);
+        navigator.mediaDevices.getUserMedia    = () => Promise.reject(new DOMException('NotAllowedError'));
+        navigator.mediaDevices.getDisplayMedia = () => Promise.reject(new DOMException('NotAllowedError'));
+    }
+
+    // 15. SPEECH
+    try {
+        if (window.speechSynthesis) {
+            window.speechSynthesis.getVoices = () => [];
+        }
+        delete window.SpeechRecognition;
+        delete window.webkitSpeechRecognition;
+    } catch(e) {}
+
+})();
+)js";
+
+// ─── Orígenes de una pestaña ──────────────────────────────────────────────────
+//
+// Cada pestaña anota los hosts de los que ha cargado algo (documento y
+// subrecursos, vía PerformanceObserver en todos los marcos) para borrar al
+// cerrarla solo los datos de esos sitios. Los hosts llegan en lotes separados
+// por espacios al manejador "prektOrigins". El script y el manejador viven en
+// el mundo aislado PREKT_WORLD: los scripts de la página no ven el manejador
+// y no pueden añadir hosts para que sus cookies sobrevivan al cierre.
+
+static const char* PREKT_WORLD = "prektbr";
+
+static const char* ORIGIN_TRACK_JS = R"js(
+(function() {
+    'use strict';
+    const h = window.webkit && window.webkit.messageHandlers && window.webkit.messageHandlers.prektOrigins;
+    if (!h) return;
+    const seen = new Set();
+    let pending = [], timer = 0;
+    const flush = () => { timer = 0; if (pending.length) h.postMessage(pending.join(' ')); pending = []; };
+    const add = (u) => {
+        try {
+            const host = new URL(u, location.href).hostname;
+            if (!host || seen.has(host)) return;
+            seen.add(host);
+            pending.push(host);
+            if (!timer) timer = setTimeout(flush, 500);
+        } catch (e) {}
+    };
+    add(location.href);
+    try {
+        new PerformanceObserver(list => list.getEntries().forEach(e => add(e.name)))
+            .observe({type: 'resource', buffered: true});
+    } catch (e) {}
+})();
+)js";
+
+static constexpr size_t TAB_ORIGINS_MAX = 512;
+
+// Los WebKitWebsiteData se nombran por dominio ("example.com"): cubren al host
+// igual y a sus subdominios.
+static bool origin_matches(const std::set<std::string>& hosts, const std::string& name) {
+    for (auto& h : hosts)
+        if (h == name || (h.size() > name.size() && h[h.size() - name.size() - 1] == '.'
+                          && h.compare(h.size() - name.size(), name.size(), name) == 0))
+            return true;
+    return false;
+}
+
+// ─── Utilidades de cadena ─────────────────────────────────────────────────────
+
+static std::string str_tolower(std::string s) {
+    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+    return s;
+}
+
+static std::string str_trim(const std::string& s) {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    if (a == std::string::npos) return "";
+    size_t b = s.find_last_not_of(" \t\r\n");
+    return s.substr(a, b - a + 1);
+}
+
+static std::string url_encode(const std::string& s) {
+    std::ostringstream o;
+    for (unsigned char c : s) {
+        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            o << c;
+        } else {
+            o << '%' << std::uppercase << std::hex << (int)c;
+        }
+    }
+    return o.str();
+}
+
+// Parsear host y scheme de una URI
+static void parse_uri(const std::string& uri, std::string& scheme, std::string& host) {
+    size_t cs = uri.find("://");
+    if (cs == std::string::npos) { scheme = ""; host = uri; return; }
+    scheme = uri.substr(0, cs);
+    size_t hs = cs + 3;
+    size_t he = uri.find_first_of("/?#", hs);
+    host = (he == std::string::npos) ? uri.substr(hs) : uri.substr(hs, he - hs);
+    // Quitar puerto
+    size_t cp = host.rfind(':');
+    if (cp != std::string::npos) host = host.substr(0, cp);
+}
+
+// Clave de índice para marcadores: esquema y host en minúsculas, sin puerto
+// por defecto, sin fragmento y sin la "/" final de una ruta vacía.
+static std::string normalize_url(const std::string& uri) {
+    std::string s = str_trim(uri);
+    size_t hash = s.find('#');
+    if (hash != std::string::npos) s.resize(hash);
+    size_t cs = s.find("://");
+    if (cs == std::string::npos) return s;
+    size_t hs = cs + 3;
+    size_t he = s.find_first_of("/?", hs);
+    if (he == std::string::npos) he = s.size();
+    std::string scheme = str_tolower(s.substr(0, cs));
+    std::string host   = str_tolower(s.substr(hs, he - hs));
+    if ((scheme == "http"  && host.size() > 3 && host.compare(host.size() - 3, 3, ":80") == 0) ||
+        (scheme == "https" && host.size() > 4 && host.compare(host.size() - 4, 4, ":443") == 0))
+        host.resize(host.rfind(':'));
+    std::string rest = s.substr(he);
+    if (rest == "/") rest.clear();
+    return scheme + "://" + host + rest;
+}
+
+// ─── Timestamps ───────────────────────────────────────────────────────────────
+//
+// Las visitas guardan segundos desde epoch (int64). history.json anterior usaba
+// cadenas "YYYY-MM-DDTHH:MM:SS" en hora local; parse_iso_ts las convierte.
+
+static int64_t now_epoch() {
+    return (int64_t)std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string format_ts(int64_t ts, const char* fmt = "%Y-%m-%d %H:%M:%S") {
+    std::time_t t = (std::time_t)ts;
+    struct tm tmv;
+    char buf[32];
+    if (!localtime_r(&t, &tmv) || !strftime(buf, sizeof(buf), fmt, &tmv)) return "";
+    return buf;
+}
+
+static int64_t parse_iso_ts(const std::string& s) {
+    struct tm tmv = {};
+    if (sscanf(s.c_str(), "%d-%d-%dT%d:%d:%d", &tmv.tm_year, &tmv.tm_mon, &tmv.tm_mday,
+               &tmv.tm_hour, &tmv.tm_min, &tmv.tm_sec) < 3)
+        return 0;
+    tmv.tm_year -= 1900;
+    tmv.tm_mon  -= 1;
+    tmv.tm_isdst = -1;
+    std::time_t t = mktime(&tmv);
+    return t < 0 ? 0 : (int64_t)t;
+}
+
+static int64_t json_ts(const json& v) {
+    if (v.is_number_integer()) return v.get<int64_t>();
+    if (v.is_string())         return parse_iso_ts(v.get<std::string>());
+    return 0;
+}
+
+// ─── Historial en memoria ─────────────────────────────────────────────────────
+//
+// Anillo de capacidad fija en formato struct-of-arrays: timestamps int64,
+// url/título como (offset, longitud) dentro de una arena de bytes y el host
+// internado como índice. Añadir una visita con el anillo lleno expulsa la más
+// antigua en O(1); los bytes muertos de la arena se recuperan compactando
+// cuando superan a los vivos (coste amortizado O(1) por visita).
+//
+// Las Entry devueltas son vistas sobre la arena: no copian nada, pero dejan de
+// ser válidas en cuanto se llama a push() o load_json().
+
+class HistoryStore {
+public:
+    struct Entry {
+        std::string_view url;
+        std::string_view title;
+        std::string_view host;
+        int64_t          ts;
+    };
+
+    explicit HistoryStore(size_t capacity)
+        : cap_(capacity), ts_(capacity), url_(capacity), title_(capacity), host_(capacity) {}
+
+    size_t size()     const { return count_; }
+    bool   empty()    const { return count_ == 0; }
+    size_t capacity() const { return cap_; }
+
+    // i = 0 es la visita más antigua
+    Entry at(size_t i) const {
+        size_t s = (head_ + i) % cap_;
+        return Entry{view(url_[s]), view(title_[s]), hosts_[host_[s]], ts_[s]};
+    }
+    // i = 0 es la visita más reciente
+    Entry recent(size_t i) const { return at(count_ - 1 - i); }
+    Entry back()           const { return recent(0); }
+
+    void push(std::string_view url, std::string_view title, int64_t ts) {
+        if (cap_ == 0) return;
+        size_t s;
+        if (count_ == cap_) {
+            s = head_;
+            release(s);
+            head_ = (head_ + 1) % cap_;
+        } else {
+            s = (head_ + count_) % cap_;
+            count_++;
+        }
+        ts_[s]    = ts;
+        url_[s]   = store(url);
+        title_[s] = store(title);
+        host_[s]  = intern(url);
+        if (dead_ > arena_.size() / 2 && arena_.size() > (64u << 10)) compact_arena();
+    }
+
+    void clear() {
+        head_ = count_ = 0;
+        arena_.clear();
+        dead_ = 0;
+        hosts_.clear();
+        host_refs_.clear();
+        host_ids_.clear();
+        free_hosts_.clear();
+    }
+
+    static json entry_json(const Entry& e) {
+        json j;
+        j["url"]   = std::string(e.url);
+        j["title"] = std::string(e.title);
+        j["ts"]    = e.ts;
+        return j;
+    }
+
+    json to_json() const {
+        json out = json::array();
+        for (size_t i = 0; i < count_; i++) out.push_back(entry_json(at(i)));
+        return out;
+    }
+
+    // Acepta history.json con "ts" entero o con la cadena ISO antigua.
+    void load_json(const json& arr) {
+        clear();
+        if (!arr.is_array()) return;
+        for (auto& h : arr) {
+            if (!h.is_object() || !h.contains("url") || !h["url"].is_string()) continue;
+            const std::string& url = h["url"].get_ref<const std::string&>();
+            auto t = h.find("title");
+            push(url, t != h.end() && t->is_string() ? t->get_ref<const std::string&>() : url,
+                 json_ts(h.value("ts", json())));
+        }
+    }
+
+private:
+    struct Span { uint32_t off = 0, len = 0; };
+
+    std::string_view view(Span sp) const { return std::string_view(arena_).substr(sp.off, sp.len); }
+
+    Span store(std::string_view s) {
+        Span sp{(uint32_t)arena_.size(), (uint32_t)s.size()};
+        arena_.append(s.data(), s.size());
+        return sp;
+    }
+
+    uint32_t intern(std::string_view url) {
+        std::string scheme, host;
+        parse_uri(std::string(url), scheme, host);
+        auto it = host_ids_.find(host);
+        if (it != host_ids_.end()) {
+            host_refs_[it->second]++;
+            return it->second;
+        }
+        uint32_t id;
+        if (!free_hosts_.empty()) {
+            id = free_hosts_.back();
+            free_hosts_.pop_back();
+            hosts_[id] = host;
+            host_refs_[id] = 1;
+        } else {
+            id = (uint32_t)hosts_.size();
+            hosts_.push_back(host);
+            host_refs_.push_back(1);
+        }
+        host_ids_.emplace(std::move(host), id);
+        return id;
+    }
+
+    void release(size_t s) {
+        dead_ += url_[s].len + title_[s].len;
+        uint32_t id = host_[s];
+        if (--host_refs_[id] == 0) {
+            host_ids_.erase(hosts_[id]);
+            hosts_[id].clear();
+            free_hosts_.push_back(id);
+        }
+    }
+
+    void compact_arena() {
+        std::string fresh;
+        fresh.reserve(arena_.size() - dead_);
+        for (size_t i = 0; i < count_; i++) {
+            size_t s = (head_ + i) % cap_;
+            for (Span* sp : {&url_[s], &title_[s]}) {
+                uint32_t off = (uint32_t)fresh.size();
+                fresh.append(arena_, sp->off, sp->len);
+                sp->off = off;
+            }
+        }
+        arena_.swap(fresh);
+        dead_ = 0;
+    }
+
+    size_t cap_;
+    size_t head_  = 0;
+    size_t count_ = 0;
+
+    std::vector<int64_t>  ts_;
+    std::vector<Span>     url_;
+    std::vector<Span>     title_;
+    std::vector<uint32_t> host_;
+
+    std::string arena_;
+    size_t      dead_ = 0;
+
+    std::vector<std::string>                  hosts_;
+    std::vector<uint32_t>                     host_refs_;
+    std::unordered_map<std::string, uint32_t> host_ids_;
+    std::vector<uint32_t>                     free_hosts_;
+};
+
+// ─── Marcadores ───────────────────────────────────────────────────────────────
+//
+// Vector en orden de inserción más un índice hash por URL normalizada. Borrar
+// deja una lápida que se recoge cuando las lápidas superan a los vivos, así que
+// buscar, añadir y quitar son O(1) amortizado. Las carpetas son rutas
+// separadas por "/" ("" = raíz) y las etiquetas una lista libre.
+//
+// Cada cambio se persiste como un registro en bookmarks.journal:
+//   {"op":"put", url, title, folder, tags, added}  (alta o modificación)
+//   {"op":"del", url}
+
+class BookmarkStore {
+public:
+    struct Bookmark {
+        std::string              url;
+        std::string              title;
+        std::string              folder;
+        std::vector<std::string> tags;
+        int64_t                  added = 0;
+        bool                     live  = true;
+    };
+
+    size_t size()  const { return live_; }
+    bool   empty() const { return live_ == 0; }
+
+    const Bookmark* find(const std::string& url) const {
+        auto it = index_.find(normalize_url(url));
+        return it == index_.end() ? nullptr : &items_[it->second];
+    }
+    bool contains(const std::string& url) const { return find(url) != nullptr; }
+
+    // Inserta o reemplaza; devuelve false si ya existía.
+    bool put(Bookmark b) {
+        std::string key = normalize_url(b.url);
+        b.live = true;
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            items_[it->second] = std::move(b);
+            return false;
+        }
+        index_.emplace(std::move(key), (uint32_t)items_.size());
+        items_.push_back(std::move(b));
+        live_++;
+        return true;
+    }
+
+    bool remove(const std::string& url) {
+        auto it = index_.find(normalize_url(url));
+        if (it == index_.end()) return false;
+        Bookmark& b = items_[it->second];
+        b.live = false;
+        b.url.clear(); b.title.clear(); b.folder.clear(); b.tags.clear();
+        index_.erase(it);
+        live_--;
+        if (items_.size() > 64 && items_.size() - live_ > live_) compact();
+        return true;
+    }
+
+    template<class F> void for_each(F&& f) const {
+        for (auto& b : items_) if (b.live) f(b);
+    }
+
+    // Acceso por hueco (incluye lápidas). Los huecos solo se renumeran al
+    // compactar o recargar, y entonces generation() cambia; el orden relativo
+    // de los vivos se conserva.
+    size_t          slots()        const { return items_.size(); }
+    const Bookmark& slot(size_t i) const { return items_[i]; }
+    uint64_t        generation()   const { return gen_; }
+    long slot_of(const std::string& url) const {
+        auto it = index_.find(normalize_url(url));
+        return it == index_.end() ? -1 : (long)it->second;
+    }
+
+    void reserve(size_t n) {
+        items_.reserve(n);
+        index_.reserve(n);
+    }
+
+    static json bookmark_json(const Bookmark& b) {
+        json j;
+        j["url"]   = b.url;
+        j["title"] = b.title;
+        if (!b.folder.empty()) j["folder"] = b.folder;
+        if (!b.tags.empty())   j["tags"]   = b.tags;
+        if (b.added)           j["added"]  = b.added;
+        return j;
+    }
+
+    static bool from_json(const json& j, Bookmark& b) {
+        if (!j.is_object() || !j.contains("url") || !j["url"].is_string()) return false;
+        b.url    = j["url"].get<std::string>();
+        b.title  = j.value("title", b.url);
+        b.folder = j.value("folder", std::string());
+        b.tags.clear();
+        auto t = j.find("tags");
+        if (t != j.end() && t->is_array())
+            for (auto& tag : *t) if (tag.is_string()) b.tags.push_back(tag.get<std::string>());
+        b.added = j.value("added", (int64_t)0);
+        return true;
+    }
+
+    json to_json() const {
+        json out = json::array();
+        for_each([&](const Bookmark& b){ out.push_back(bookmark_json(b)); });
+        return out;
+    }
+
+    void load_json(const json& arr) {
+        items_.clear();
+        index_.clear();
+        live_ = 0;
+        gen_++;
+        if (!arr.is_array()) return;
+        reserve(arr.size());
+        Bookmark b;
+        for (auto& j : arr)
+            if (from_json(j, b)) put(std::move(b));
+    }
+
+    // Aplica un registro del diario
+    void apply(const json& rec) {
+        if (!rec.is_object()) return;
+        std::string op = rec.value("op", "");
+        if (op == "put") {
+            Bookmark b;
+            if (from_json(rec, b)) put(std::move(b));
+        } else if (op == "del" && rec.contains("url") && rec["url"].is_string()) {
+            remove(rec["url"].get<std::string>());
+        }
+    }
+
+    static json put_record(const Bookmark& b) {
+        json j = bookmark_json(b);
+        j["op"] = "put";
+        return j;
+    }
+
+    static json del_record(const std::string& url) {
+        return json{{"op", "del"}, {"url", url}};
+    }
+
+private:
+    void compact() {
+        std::vector<Bookmark> fresh;
+        fresh.reserve(live_);
+        index_.clear();
+        for (auto& b : items_) {
+            if (!b.live) continue;
+            index_.emplace(normalize_url(b.url), (uint32_t)fresh.size());
+            fresh.push_back(std::move(b));
+        }
+        items_.swap(fresh);
+        gen_++;
+    }
+
+    std::vector<Bookmark>                     items_;
+    std::unordered_map<std::string, uint32_t> index_;
+    size_t                                    live_ = 0;
+    uint64_t                                  gen_  = 0;
+};
+
+// ─── Importación de marcadores (Netscape HTML) ────────────────────────────────
+//
+// Parser en streaming del formato que exportan Firefox, Chrome y compañía:
+//
+//   <DT><H3>Carpeta</H3>
+//   <DL><p>
+//       <DT><A HREF="..." ADD_DATE="..." TAGS="a,b">Título</A>
+//   </DL><p>
+//
+// Lee el archivo en bloques de 64 KB y procesa carácter a carácter con una
+// pila de carpetas, sin construir nunca un árbol ni cargar el archivo entero.
+// Los atributos ICON con data: pueden ser enormes; las etiquetas de más de
+// 1 MB se descartan.
+
+class NetscapeImporter {
+public:
+    std::vector<BookmarkStore::Bookmark> out;
+
+    bool import_file(const std::string& path) {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin) return false;
+        std::vector<char> buf(64 << 10);
+        while (fin) {
+            fin.read(buf.data(), (std::streamsize)buf.size());
+            std::streamsize n = fin.gcount();
+            if (n <= 0) break;
+            feed(buf.data(), (size_t)n);
+        }
+        return true;
+    }
+
+    void feed(const char* p, size_t n) {
+        const char* end = p + n;
+        while (p < end) {
+            if (!in_tag_) {
+                const char* lt = static_cast<const char*>(memchr(p, '<', end - p));
+                const char* stop = lt ? lt : end;
+                if ((in_a_ || in_h3_) && text_.size() < 4096)
+                    text_.append(p, std::min<size_t>(stop - p, 4096 - text_.size()));
+                if (!lt) return;
+                p = lt + 1;
+                in_tag_ = true;
+                quote_  = 0;
+                tag_.clear();
+                continue;
+            }
+            // Copiar hasta el '>' que cierra la etiqueta, saltando comillas
+            const char* s = p;
+            while (p < end) {
+                char c = *p;
+                if (quote_) {
+                    const char* q = static_cast<const char*>(memchr(p, quote_, end - p));
+                    p = q ? q + 1 : end;
+                    if (q) quote_ = 0;
+                    continue;
+                }
+                if (c == '"' || c == '\'') { quote_ = c; p++; continue; }
+                if (c == '>') break;
+                p++;
+            }
+            if (tag_.size() <= (1u << 20)) tag_.append(s, std::min<size_t>(p - s, (1u << 20) + 1));
+            if (p < end) {
+                p++;
+                in_tag_ = false;
+                if (tag_.size() <= (1u << 20)) on_tag();
+            }
+        }
+    }
+
+private:
+    void on_tag() {
+        size_t i = 0;
+        bool closing = !tag_.empty() && tag_[0] == '/';
+        if (closing) i++;
+        size_t ns = i;
+        while (i < tag_.size() && isalnum((unsigned char)tag_[i])) i++;
+        std::string name = str_tolower(tag_.substr(ns, i - ns));
+
+        if (name == "a" && !closing) {
+            cur_ = BookmarkStore::Bookmark();
+            cur_.url   = html_unescape(attr(i, "href"));
+            cur_.added = atoll(attr(i, "add_date").c_str());
+            std::string tags = html_unescape(attr(i, "tags"));
+            size_t s = 0;
+            while (s <= tags.size()) {
+                size_t e = tags.find(',', s);
+                if (e == std::string::npos) e = tags.size();
+                std::string t = str_trim(tags.substr(s, e - s));
+                if (!t.empty()) cur_.tags.push_back(t);
+                s = e + 1;
+            }
+            cur_.folder = folder_path();
+            in_a_ = true;
+            text_.clear();
+        } else if (name == "a" && in_a_) {
+            in_a_ = false;
+            cur_.title = html_unescape(str_trim(text_));
+            // Los "place:" de Firefox son consultas guardadas, no páginas
+            if (!cur_.url.empty() && cur_.url.compare(0, 6, "place:") != 0 &&
+                cur_.url.compare(0, 11, "javascript:") != 0) {
+                if (cur_.title.empty()) cur_.title = cur_.url;
+                out.push_back(std::move(cur_));
+            }
+        } else if (name == "h3") {
+            in_h3_ = !closing;
+            if (closing) pending_folder_ = html_unescape(str_trim(text_));
+            text_.clear();
+        } else if (name == "dl") {
+            if (closing) {
+                if (!folders_.empty()) folders_.pop_back();
+            } else {
+                folders_.push_back(pending_folder_);
+                pending_folder_.clear();
+            }
+        }
+    }
+
+    // Valor del atributo `key` (en minúsculas) a partir de la posición i
+    std::string attr(size_t i, const char* key) const {
+        while (i < tag_.size()) {
+            while (i < tag_.size() && isspace((unsigned char)tag_[i])) i++;
+            size_t ks = i;
+            while (i < tag_.size() && tag_[i] != '=' && !isspace((unsigned char)tag_[i])) i++;
+            bool match = i - ks == strlen(key) && strncasecmp(tag_.data() + ks, key, i - ks) == 0;
+            while (i < tag_.size() && isspace((unsigned char)tag_[i])) i++;
+            if (i >= tag_.size() || tag_[i] != '=') { if (i == ks) i++; continue; }
+            i++;
+            while (i < tag_.size() && isspace((unsigned char)tag_[i])) i++;
+            size_t vs, ve;
+            if (i < tag_.size() && (tag_[i] == '"' || tag_[i] == '\'')) {
+                char q = tag_[i++];
+                vs = i;
+                while (i < tag_.size() && tag_[i] != q) i++;
+                ve = i++;
+            } else {
+                vs = i;
+                while (i < tag_.size() && !isspace((unsigned char)tag_[i])) i++;
+                ve = i;
+            }
+            if (match) return tag_.substr(vs, std::min(ve, tag_.size()) - vs);
+        }
+        return "";
+    }
+
+    std::string folder_path() const {
+        std::string path;
+        for (auto& f : folders_) {
+            if (f.empty()) continue;
+            if (!path.empty()) path += '/';
+            path += f;
+        }
+        return path;
+    }
+
+    static std::string html_unescape(const std::string& s) {
+        if (s.find('&') == std::string::npos) return s;
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); i++) {
+            size_t semi;
+            if (s[i] != '&' || (semi = s.find(';', i)) == std::string::npos || semi - i > 10) {
+                out.push_back(s[i]);
+                continue;
+            }
+            std::string ent = s.substr(i + 1, semi - i - 1);
+            long cp = -1;
+            if      (ent == "amp")  cp = '&';
+            else if (ent == "lt")   cp = '<';
+            else if (ent == "gt")   cp = '>';
+            else if (ent == "quot") cp = '"';
+            else if (ent == "apos") cp = '\'';
+            else if (ent.size() > 1 && ent[0] == '#')
+                cp = (ent[1] == 'x' || ent[1] == 'X') ? strtol(ent.c_str() + 2, nullptr, 16)
+                                                      : strtol(ent.c_str() + 1, nullptr, 10);
+            if (cp <= 0 || cp > 0x10FFFF) {
+                out.push_back(s[i]);
+                continue;
+            }
+            // UTF-8
+            if (cp < 0x80) {
+                out.push_back((char)cp);
+            } else if (cp < 0x800) {
+                out.push_back((char)(0xC0 | (cp >> 6)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            } else if (cp < 0x10000) {
+                out.push_back((char)(0xE0 | (cp >> 12)));
+                out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            } else {
+                out.push_back((char)(0xF0 | (cp >> 18)));
+                out.push_back((char)(0x80 | ((cp >> 12) & 0x3F)));
+                out.push_back((char)(0x80 | ((cp >> 6) & 0x3F)));
+                out.push_back((char)(0x80 | (cp & 0x3F)));
+            }
+            i = semi;
+        }
+        return out;
+    }
+
+    bool        in_tag_ = false;
+    char        quote_  = 0;
+    bool        in_a_   = false;
+    bool        in_h3_  = false;
+    std::string tag_;
+    std::string text_;
+    std::string pending_folder_;
+    std::vector<std::string> folders_;
+    BookmarkStore::Bookmark  cur_;
+};
+
+// ─── Índice de búsqueda (trigramas) ───────────────────────────────────────────
+//
+// Un documento por URL normalizada, con el título más reciente, número de
+// visitas dentro del historial, última visita y si está en marcadores. El
+// texto indexado es url + título en minúsculas; cada trigrama de bytes apunta
+// a una lista ordenada de ids de documento.
+//
+// Una consulta intersecta las listas de los trigramas de cada término
+// (empezando por la más corta), confirma los candidatos con una búsqueda de
+// subcadena y ordena por coincidencia + visitas + recencia + marcador. Los
+// términos de menos de 3 letras solo filtran candidatos.
+//
+// Para la barra de direcciones hay además listas por prefijo (1–3 bytes) del
+// host, del host sin "www." y de cada palabra del título. suggest() toma la
+// lista del prefijo tecleado, confirma los candidatos y se queda con los k de
+// mayor frecencia: visitas con decaimiento exponencial (vida media de 30 días)
+// guardadas como log2(puntuación) + ts / vida_media, que se compara entre
+// documentos sin depender de la hora actual.
+//
+// Las altas y cambios de título solo añaden postings. Los documentos muertos
+// (sin visitas ni marcador) quedan en las listas hasta que superan a los
+// vivos y se reconstruye el índice, así que el mantenimiento es O(1)
+// amortizado por visita.
+
+class SearchIndex {
+public:
+    struct Doc {
+        std::string url;
+        std::string title;
+        std::string hay;      // minúsculas: url '\1' título
+        int64_t     last_ts    = 0;
+        uint32_t    visits     = 0;
+        bool        bookmarked = false;
+        bool        alive      = true;
+        double      frec       = 0;     // Σ 2^-(frec_ts - ts_visita) / vida media
+        int64_t     frec_ts    = 0;
+        double      rank       = -1e300; // log2(frec) + frec_ts / vida media
+    };
+
+    static constexpr double FRECENCY_HALF_LIFE = 30 * 86400.0;
+
+    struct Hit {
+        uint32_t doc;
+        double   score;
+    };
+
+    enum class Filter { Any, Visited, Bookmarked };
+
+    size_t size() const { return by_url_.size(); }
+    const Doc& doc(uint32_t id) const { return docs_[id]; }
+    bool dirty() const { return dirty_; }
+    void mark_clean() { dirty_ = false; }
+
+    void visit(const std::string& url, const std::string& title, int64_t ts) {
+        Doc* d = find_or_add(url, title);
+        d->visits++;
+        if (ts >= d->frec_ts) {
+            d->frec = d->frec * decay(ts - d->frec_ts) + 1.0;
+            d->frec_ts = ts;
+        } else {
+            d->frec += decay(d->frec_ts - ts);
+        }
+        update_rank(*d);
+        if (ts >= d->last_ts) {
+            d->last_ts = ts;
+            retitle(*d, title);
+        }
+        dirty_ = true;
+    }
+
+    // El historial expulsó la visita `ts` de esta URL
+    void unvisit(const std::string& url, int64_t ts) {
+        auto it = by_url_.find(normalize_url(url));
+        if (it == by_url_.end()) return;
+        Doc& d = docs_[it->second];
+        if (d.visits) d.visits--;
+        d.frec = d.visits ? std::max(0.0, d.frec - decay(d.frec_ts - ts)) : 0.0;
+        update_rank(d);
+        if (!d.visits && !d.bookmarked) kill(it);
+        dirty_ = true;
+    }
+
+    void set_bookmarked(const std::string& url, const std::string& title, bool on) {
+        if (on) {
+            Doc* d = find_or_add(url, title);
+            d->bookmarked = true;
+        } else {
+            auto it = by_url_.find(normalize_url(url));
+            if (it == by_url_.end()) return;
+            docs_[it->second].bookmarked = false;
+            if (!docs_[it->second].visits) kill(it);
+        }
+        dirty_ = true;
+    }
+
+    std::vector<Hit> search(const std::string& query, size_t limit, Filter filter = Filter::Any,
+                            int64_t now = 0) const {
+        std::vector<std::string> terms;
+        {
+            std::istringstream ss(str_tolower(query));
+            std::string t;
+            while (ss >> t) terms.push_back(t);
+        }
+        std::vector<Hit> hits;
+        if (terms.empty() || limit == 0) return hits;
+
+        // Listas de postings de todos los trigramas, de la más corta a la más larga
+        std::vector<const std::vector<uint32_t>*> lists;
+        for (auto& t : terms) {
+            for (size_t i = 0; i + 3 <= t.size(); i++) {
+                auto it = postings_.find(trigram(&t[i]));
+                if (it == postings_.end()) return hits;
+                lists.push_back(&it->second);
+            }
+        }
+        std::sort(lists.begin(), lists.end(),
+                  [](auto* a, auto* b){ return a->size() < b->size(); });
+        lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+        std::vector<uint32_t> cand;
+        if (lists.empty()) {
+            cand.resize(docs_.size());
+            for (uint32_t i = 0; i < cand.size(); i++) cand[i] = i;
+        } else {
+            cand = *lists[0];
+            std::vector<uint32_t> next;
+            for (size_t l = 1; l < lists.size() && !cand.empty(); l++) {
+                next.clear();
+                const auto& big = *lists[l];
+                auto lo = big.begin();
+                for (uint32_t id : cand) {
+                    lo = std::lower_bound(lo, big.end(), id);
+                    if (lo == big.end()) break;
+                    if (*lo == id) next.push_back(id);
+                }
+                cand.swap(next);
+            }
+        }
+
+        if (!now) now = now_epoch();
+        for (uint32_t id : cand) {
+            const Doc& d = docs_[id];
+            if (!d.alive) continue;
+            if (filter == Filter::Visited && !d.visits) continue;
+            if (filter == Filter::Bookmarked && !d.bookmarked) continue;
+            double score = 0;
+            size_t title_at = d.hay.find('\1');
+            size_t host_at  = d.hay.find("://");
+            host_at = host_at < title_at ? host_at + 3 : 0;
+            size_t host_end = d.hay.find_first_of("/?\1", host_at);
+            bool ok = true;
+            for (auto& t : terms) {
+                size_t pos = d.hay.find(t);
+                if (pos == std::string::npos) { ok = false; break; }
+                score += 1.0;
+                if (pos >= host_at && pos < host_end) score += 1.5;
+                size_t tpos = d.hay.find(t, title_at);
+                if (tpos != std::string::npos) {
+                    score += 1.0;
+                    // Inicio de palabra en el título
+                    if (!isalnum((unsigned char)d.hay[tpos - 1])) score += 1.0;
+                }
+            }
+            if (!ok) continue;
+            double age_days = std::max<int64_t>(0, now - d.last_ts) / 86400.0;
+            score += std::log2(1.0 + d.visits) + 2.0 / (1.0 + age_days / 7.0);
+            if (d.bookmarked) score += 1.5;
+            hits.push_back({id, score});
+        }
+        size_t k = std::min(limit, hits.size());
+        std::partial_sort(hits.begin(), hits.begin() + k, hits.end(),
+            [&](const Hit& a, const Hit& b){
+                if (a.score != b.score) return a.score > b.score;
+                return docs_[a.doc].last_ts > docs_[b.doc].last_ts;
+            });
+        hits.resize(k);
+        return hits;
+    }
+
+    // Autocompletado: hasta k documentos cuyo host (con o sin "www.") o alguna
+    // palabra del título empiece por `typed`. Coincidir en el host cuenta como
+    // el doble de frecuente; un marcador sin visitas cuenta como media visita
+    // hoy.
+    std::vector<Hit> suggest(const std::string& typed, size_t k, int64_t now = 0) const {
+        std::vector<Hit> hits;
+        std::string q = str_tolower(str_trim(typed));
+        for (const char* lead : {"https://", "http://", "www."})
+            if (q.compare(0, strlen(lead), lead) == 0) q.erase(0, strlen(lead));
+        if (q.empty() || k == 0) return hits;
+        if (!now) now = now_epoch();
+        double bm_rank = std::log2(0.5) + now / FRECENCY_HALF_LIFE;
+        size_t plen = std::min<size_t>(3, q.size());
+
+        // Montículo de mínimos con los 2k mejores; luego se quitan duplicados
+        auto worse = [](const Hit& a, const Hit& b){ return a.score > b.score; };
+        auto offer = [&](uint32_t id, double score) {
+            if (hits.size() < 2 * k) {
+                hits.push_back({id, score});
+                std::push_heap(hits.begin(), hits.end(), worse);
+            } else if (score > hits.front().score) {
+                std::pop_heap(hits.begin(), hits.end(), worse);
+                hits.back() = {id, score};
+                std::push_heap(hits.begin(), hits.end(), worse);
+            }
+        };
+
+        for (bool host : {true, false}) {
+            auto it = postings_.find(prefix_key(q.data(), plen, host));
+            if (it == postings_.end()) continue;
+            // De los ids más nuevos a los más viejos: los recientes suelen tener
+            // más frecencia y llenan pronto el montículo, lo que poda el resto
+            const auto& ids = it->second;
+            for (auto r = ids.rbegin(); r != ids.rend(); ++r) {
+                uint32_t id = *r;
+                const Doc& d = docs_[id];
+                if (!d.alive) continue;
+                double score = std::max(d.rank, d.bookmarked ? bm_rank : -1e300);
+                if (host) score += 1.0;
+                // Sin podar, un candidato que no puede entrar no merece verificarse
+                if (hits.size() >= 2 * k && score <= hits.front().score) continue;
+                // Las listas de host son exactas hasta 3 bytes; las de palabras
+                // pueden tener títulos antiguos
+                if ((q.size() > plen || !host) && !prefix_match(d, q, host)) continue;
+                offer(id, score);
+            }
+        }
+
+        std::sort(hits.begin(), hits.end(), worse);
+        std::vector<Hit> out;
+        for (auto& h : hits) {
+            bool dup = false;
+            for (auto& o : out) if (o.doc == h.doc) { dup = true; break; }
+            if (!dup) out.push_back(h);
+            if (out.size() == k) break;
+        }
+        return out;
+    }
+
+    // Ajusta el índice cargado de disco al historial y marcadores reales:
+    // solo se tokenizan los documentos nuevos o con título distinto.
+    void reconcile(const HistoryStore& history, const BookmarkStore& bookmarks) {
+        struct Want {
+            std::string url, title;
+            int64_t     ts = 0;
+            uint32_t    visits = 0;
+            bool        bookmarked = false;
+            double      frec = 0;
+        };
+        int64_t now = now_epoch();
+        std::unordered_map<std::string, Want> want;
+        want.reserve(history.size() + bookmarks.size());
+        for (size_t i = 0; i < history.size(); i++) {
+            auto h = history.at(i);
+            Want& w = want[normalize_url(std::string(h.url))];
+            w.visits++;
+            w.frec += decay(now - h.ts);
+            if (h.ts >= w.ts || w.url.empty()) {
+                w.ts = h.ts;
+                w.url.assign(h.url);
+                w.title.assign(h.title);
+            }
+        }
+        bookmarks.for_each([&](const BookmarkStore::Bookmark& b){
+            Want& w = want[normalize_url(b.url)];
+            w.bookmarked = true;
+            if (w.url.empty()) { w.url = b.url; w.title = b.title; }
+        });
+
+        for (auto it = by_url_.begin(); it != by_url_.end(); ) {
+            auto wi = want.find(it->first);
+            if (wi == want.end()) {
+                docs_[it->second].alive = false;
+                dead_++;
+                it = by_url_.erase(it);
+                dirty_ = true;
+                continue;
+            }
+            Doc& d = docs_[it->second];
+            const Want& w = wi->second;
+            if (d.visits != w.visits || d.last_ts != w.ts || d.bookmarked != w.bookmarked)
+                dirty_ = true;
+            d.visits = w.visits;
+            d.last_ts = w.ts;
+            d.bookmarked = w.bookmarked;
+            d.frec = w.frec;
+            d.frec_ts = now;
+            update_rank(d);
+            retitle(d, w.title);
+            want.erase(wi);
+            ++it;
+        }
+        for (auto& [key, w] : want) {
+            Doc* d = find_or_add(w.url, w.title);
+            d->visits = w.visits;
+            d->last_ts = w.ts;
+            d->bookmarked = w.bookmarked;
+            d->frec = w.frec;
+            d->frec_ts = now;
+            update_rank(*d);
+            dirty_ = true;
+        }
+        maybe_rebuild();
+    }
+
+    // Formato: "PKSI" u32 versión | u32 n_docs | docs | u32 n_trigramas | listas
+    // doc:   u32+url | u32+título | i64 última visita | u32 visitas | u8 marcador
+    // lista: u32 trigrama | u32 n | n × varint (diferencia con el id anterior)
+    // Los documentos muertos se omiten y los ids se renumeran.
+    std::string serialize() const {
+        std::vector<uint32_t> remap(docs_.size(), UINT32_MAX);
+        uint32_t next = 0;
+        for (uint32_t i = 0; i < docs_.size(); i++)
+            if (docs_[i].alive) remap[i] = next++;
+
+        std::string out("PKSI", 4);
+        put_u32(out, 2);
+        put_u32(out, next);
+        for (auto& d : docs_) {
+            if (!d.alive) continue;
+            put_u32(out, (uint32_t)d.url.size());   out += d.url;
+            put_u32(out, (uint32_t)d.title.size()); out += d.title;
+            put_u32(out, (uint32_t)d.last_ts);
+            put_u32(out, (uint32_t)((uint64_t)d.last_ts >> 32));
+            put_u32(out, d.visits);
+            out.push_back(d.bookmarked ? 1 : 0);
+        }
+        size_t count_at = out.size();
+        put_u32(out, 0);
+        uint32_t lists = 0;
+        for (auto& [tri, ids] : postings_) {
+            size_t head = out.size();
+            put_u32(out, tri);
+            put_u32(out, 0);
+            uint32_t n = 0, prev = 0;
+            for (uint32_t id : ids) {
+                if (remap[id] == UINT32_MAX) continue;
+                uint32_t delta = remap[id] - prev;
+                prev = remap[id];
+                while (delta >= 0x80) { out.push_back((char)(delta | 0x80)); delta >>= 7; }
+                out.push_back((char)delta);
+                n++;
+            }
+            if (!n) { out.resize(head); continue; }
+            for (int b = 0; b < 4; b++) out[head + 4 + b] = (char)(n >> (8 * b));
+            lists++;
+        }
+        for (int b = 0; b < 4; b++) out[count_at + b] = (char)(lists >> (8 * b));
+        return out;
+    }
+
+    bool deserialize(const std::string& in) {
+        clear();
+        const uint8_t* p   = reinterpret_cast<const uint8_t*>(in.data());
+        const uint8_t* end = p + in.size();
+        auto need = [&](size_t n){ return (size_t)(end - p) >= n; };
+        auto u32  = [&]{ uint32_t v = get_u32(p); p += 4; return v; };
+        if (!need(12) || memcmp(p, "PKSI", 4) != 0) return false;
+        p += 4;
+        if (u32() != 2) return false;
+        uint32_t ndocs = u32();
+        docs_.reserve(ndocs);
+        by_url_.reserve(ndocs);
+        for (uint32_t i = 0; i < ndocs; i++) {
+            Doc d;
+            if (!need(4)) return fail();
+            uint32_t n = u32();
+            if (!need(n + 4)) return fail();
+            d.url.assign(reinterpret_cast<const char*>(p), n); p += n;
+            n = u32();
+            if (!need(n + 13)) return fail();
+            d.title.assign(reinterpret_cast<const char*>(p), n); p += n;
+            uint64_t lo = u32(), hi = u32();
+            d.last_ts = (int64_t)(lo | (hi << 32));
+            d.visits = u32();
+            d.bookmarked = *p++ != 0;
+            d.hay = make_hay(d.url, d.title);
+            by_url_.emplace(normalize_url(d.url), (uint32_t)docs_.size());
+            docs_.push_back(std::move(d));
+        }
+        if (!need(4)) return fail();
+        uint32_t lists = u32();
+        postings_.reserve(lists);
+        for (uint32_t l = 0; l < lists; l++) {
+            if (!need(8)) return fail();
+            uint32_t tri = u32(), n = u32();
+            if (!need(n)) return fail();
+            auto& ids = postings_[tri];
+            ids.resize(n);
+            uint32_t id = 0;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t delta = 0;
+                for (int shift = 0; ; shift += 7) {
+                    if (p == end || shift > 28) return fail();
+                    uint8_t b = *p++;
+                    delta |= (uint32_t)(b & 0x7F) << shift;
+                    if (!(b & 0x80)) break;
+                }
+                id += delta;
+                if (id >= ndocs || (i && delta == 0)) return fail();
+                ids[i] = id;
+            }
+        }
+        return true;
+    }
+
+private:
+    using UrlMap = std::unordered_map<std::string, uint32_t>;
+
+    static uint32_t trigram(const char* s) {
+        return ((uint32_t)(uint8_t)s[0] << 16) | ((uint32_t)(uint8_t)s[1] << 8) | (uint8_t)s[2];
+    }
+
+    // Listas de prefijo: byte alto 0x1n (host) o 0x2n (palabra), n = longitud.
+    // Los trigramas siempre tienen el byte alto a 0.
+    static uint32_t prefix_key(const char* s, size_t len, bool host) {
+        uint32_t k = (uint32_t)((host ? 0x10 : 0x20) | len) << 24;
+        for (size_t i = 0; i < len; i++) k |= (uint32_t)(uint8_t)s[i] << (16 - 8 * i);
+        return k;
+    }
 
-    // 10. FUENTES
-    if (document.fonts && document.fonts.check) {
-        const generic = ['serif','sans-serif','monospace','cursive','fantasy','system-ui'];
-        const origCheck = document.fonts.check.bind(document.fonts);
-        document.fonts.check = (font, txt) =>
-            generic.some(g => font.toLowerCase().includes(g)) ? origCheck(font, txt) : false;
-        const origLoad = document.fonts.load.bind(document.fonts);
-        document.fonts.load = (font, txt) =>
-            generic.some(g => font.toLowerCase().includes(g)) ? origLoad(font, txt) : Promise.resolve([]);
+    static bool is_word_byte(char c) {
+        return isalnum((unsigned char)c) || (unsigned char)c >= 0x80;
     }
 
-    // 11. WINDOW.NAME
-    window.name = '';
+    static double decay(int64_t dt) {
+        return std::exp2(-(double)dt / FRECENCY_HALF_LIFE);
+    }
 
-    // 12. NETWORK INFORMATION API
-    try {
-        Object.defineProperty(navigator, 'onLine', { get: () => true, configurable: true });
-    } catch(e) {}
+    static void update_rank(Doc& d) {
+        d.rank = d.frec > 0 ? std::log2(d.frec) + d.frec_ts / FRECENCY_HALF_LIFE : -1e300;
+    }
 
-    // 13. GEOLOCATION
-    if (navigator.geolocation) {
-        navigator.geolocation.getCurrentPosition = (ok, err) => {
-            if (err) err({ code: 1, message: 'Permission denied' });
-        };
-        navigator.geolocation.watchPosition = (ok, err) => {
-            if (err) err({ code: 1, message: 'Permission denied' });
-            return 0;
-        };
+    static size_t host_start(const std::string& hay, size_t title_at) {
+        size_t hs = hay.find("://");
+        return hs != std::string::npos && hs < title_at ? hs + 3 : 0;
     }
 
-    // 14. MEDIA DEVICES
-    if (navigator.mediaDevices) {
-        navigator.mediaDevices.enumerateDevices = () => Promise.resolve([]);
-        navigator.mediaDevices.getUserMedia    = () => Promise.reject(new DOMException('NotAllowedError'));
-        navigator.mediaDevices.getDisplayMedia = () => Promise.reject(new DOMException('NotAllowedError'));
+    static std::string make_hay(const std::string& url, const std::string& title) {
+        return str_tolower(url) + '\1' + str_tolower(title);
     }
 
-    // 15. SPEECH
-    try {
-        if (window.speechSynthesis) {
-            window.speechSynthesis.getVoices = () => [];
-        }
-        delete window.SpeechRecognition;
-        delete window.webkitSpeechRecognition;
-    } catch(e) {}
+    void clear() {
+        docs_.clear();
+        by_url_.clear();
+        postings_.clear();
+        dead_ = 0;
+    }
 
-})();
-)js";
+    bool fail() {
+        clear();
+        return false;
+    }
 
-// ─── Utilidades de cadena ─────────────────────────────────────────────────────
+    void add_posting(uint32_t key, uint32_t id) {
+        auto& ids = postings_[key];
+        if (ids.empty() || ids.back() < id) {
+            ids.push_back(id);
+        } else {
+            auto at = std::lower_bound(ids.begin(), ids.end(), id);
+            if (at == ids.end() || *at != id) ids.insert(at, id);
+        }
+    }
 
-static std::string str_tolower(std::string s) {
-    std::transform(s.begin(), s.end(), s.begin(), ::tolower);
-    return s;
-}
+    void add_prefixes(uint32_t id, const std::string& text, size_t at, size_t end, bool host) {
+        for (size_t len = 1; len <= 3 && at + len <= end; len++)
+            add_posting(prefix_key(&text[at], len, host), id);
+    }
 
-static std::string str_trim(const std::string& s) {
-    size_t a = s.find_first_not_of(" \t\r\n");
-    if (a == std::string::npos) return "";
-    size_t b = s.find_last_not_of(" \t\r\n");
-    return s.substr(a, b - a + 1);
-}
+    void index_text(uint32_t id, const std::string& text) {
+        for (size_t i = 0; i + 3 <= text.size(); i++) {
+            if (text[i] == '\1' || text[i + 1] == '\1' || text[i + 2] == '\1') continue;
+            add_posting(trigram(&text[i]), id);
+        }
+        size_t title_at = std::min(text.find('\1'), text.size());
+        size_t hs = host_start(text, title_at);
+        add_prefixes(id, text, hs, title_at, true);
+        if (text.compare(hs, 4, "www.") == 0) add_prefixes(id, text, hs + 4, title_at, true);
+        for (size_t i = title_at + 1; i < text.size(); i++)
+            if (is_word_byte(text[i]) && !is_word_byte(text[i - 1]))
+                add_prefixes(id, text, i, text.size(), false);
+    }
 
-static std::string url_encode(const std::string& s) {
-    std::ostringstream o;
-    for (unsigned char c : s) {
-        if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
-            o << c;
-        } else {
-            o << '%' << std::uppercase << std::hex << (int)c;
+    // ¿Empieza el host (o una palabra del título) por q?
+    static bool prefix_match(const Doc& d, const std::string& q, bool host) {
+        const std::string& hay = d.hay;
+        size_t title_at = std::min(hay.find('\1'), hay.size());
+        if (host) {
+            size_t hs = host_start(hay, title_at);
+            if (hay.compare(hs, q.size(), q) == 0) return true;
+            return hay.compare(hs, 4, "www.") == 0 && hay.compare(hs + 4, q.size(), q) == 0;
         }
+        for (size_t i = hay.find(q, title_at); i != std::string::npos; i = hay.find(q, i + 1))
+            if (!is_word_byte(hay[i - 1])) return true;
+        return false;
     }
-    return o.str();
-}
 
-// Parsear host y scheme de una URI
-static void parse_uri(const std::string& uri, std::string& scheme, std::string& host) {
-    size_t cs = uri.find("://");
-    if (cs == std::string::npos) { scheme = ""; host = uri; return; }
-    scheme = uri.substr(0, cs);
-    size_t hs = cs + 3;
-    size_t he = uri.find_first_of("/?#", hs);
-    host = (he == std::string::npos) ? uri.substr(hs) : uri.substr(hs, he - hs);
-    // Quitar puerto
-    size_t cp = host.rfind(':');
-    if (cp != std::string::npos) host = host.substr(0, cp);
-}
+    Doc* find_or_add(const std::string& url, const std::string& title) {
+        std::string key = normalize_url(url);
+        auto it = by_url_.find(key);
+        if (it != by_url_.end()) return &docs_[it->second];
+        uint32_t id = (uint32_t)docs_.size();
+        Doc d;
+        d.url   = url;
+        d.title = title;
+        d.hay   = make_hay(url, title);
+        index_text(id, d.hay);
+        docs_.push_back(std::move(d));
+        by_url_.emplace(std::move(key), id);
+        return &docs_.back();
+    }
 
-// ─── Timestamp ISO ────────────────────────────────────────────────────────────
+    // Las postings del título anterior se quedan: la verificación por
+    // subcadena descarta esos falsos positivos.
+    void retitle(Doc& d, const std::string& title) {
+        if (title.empty() || title == d.title) return;
+        d.title = title;
+        d.hay = make_hay(d.url, title);
+        index_text((uint32_t)(&d - docs_.data()), d.hay);
+    }
 
-static std::string now_iso() {
-    auto now = std::chrono::system_clock::now();
-    std::time_t t = std::chrono::system_clock::to_time_t(now);
-    char buf[32];
-    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", localtime(&t));
-    return buf;
-}
+    void kill(UrlMap::iterator it) {
+        docs_[it->second].alive = false;
+        docs_[it->second].url.clear();
+        docs_[it->second].title.clear();
+        docs_[it->second].hay.clear();
+        by_url_.erase(it);
+        dead_++;
+        maybe_rebuild();
+    }
+
+    void maybe_rebuild() {
+        if (dead_ < 1024 || dead_ < by_url_.size()) return;
+        std::vector<Doc> old;
+        old.swap(docs_);
+        by_url_.clear();
+        postings_.clear();
+        dead_ = 0;
+        for (auto& d : old) {
+            if (!d.alive) continue;
+            uint32_t id = (uint32_t)docs_.size();
+            index_text(id, d.hay);
+            by_url_.emplace(normalize_url(d.url), id);
+            docs_.push_back(std::move(d));
+        }
+    }
+
+    std::vector<Doc>                                     docs_;
+    UrlMap                                               by_url_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>>  postings_;
+    size_t                                               dead_  = 0;
+    bool                                                 dirty_ = false;
+};
 
 // ─── Evaluador de expresiones matemáticas (safe_eval) ─────────────────────────
 
@@ -1063,13 +3422,849 @@ static std::string format_html(const std::string& html) {
     return out;
 }
 
-// ─── Datos de pestaña ─────────────────────────────────────────────────────────
+// ─── Datos de pestaña ─────────────────────────────────────────────────────────
+
+// Cada WebView apunta a su TabData mediante qdata, así que las señales del
+// WebView llegan a su pestaña en O(1) sin recorrer la lista. BrowserWindow es
+// el dueño de los TabData (unique_ptr): su dirección no cambia al abrir o
+// cerrar otras pestañas.
+
+struct TabData {
+    uint32_t       id = 0;               // estable: nombre en tab_stack y clave de los callbacks
+    WebKitWebView* webview    = nullptr;
+    std::string    mode;                 // "normal" | "tor" | "i2p"
+    GtkWidget*     tab_widget = nullptr; // el Box de pestaña en la barra
+    GtkButton*     title_btn  = nullptr; // botón de título dentro del tab_widget
+
+    // Estado de carga
+    std::string    last_uri;
+    std::string    title;
+    bool           loading       = false;
+    bool           provisional   = false; // carga principal iniciada, sin confirmar
+    double         progress      = 0;
+    int64_t        load_start_us = 0;
+    double         last_load_ms  = 0;
+
+    // Descarte: sin WebView, la pestaña se muestra como una captura reducida
+    // (placeholder) y se restaura desde session al volver a ella.
+    int64_t                    last_active_us = 0;
+    bool                       discarding     = false;
+    WebKitWebViewSessionState* session        = nullptr;
+    GdkTexture*                snapshot       = nullptr;
+    GtkWidget*                 placeholder    = nullptr;
+    size_t                     discarded_bytes = 0;
+
+    // Cambio de modo: el WebView anterior sigue visible hasta que el nuevo
+    // confirma su primera carga; el desplazamiento se aplica al terminarla.
+    WebKitWebView* retiring      = nullptr;
+    std::string    retiring_mode;
+    bool           scroll_pending = false;
+    double         scroll_x = 0, scroll_y = 0;
+
+    // Hosts vistos en la pestaña (ORIGIN_TRACK_JS y cargas confirmadas)
+    std::set<std::string> origins;
+
+    // Mejora a HTTPS: host de la carga http:// en curso (para aprender si
+    // acaba en https) y último host reescrito (para no entrar en bucle)
+    std::string http_host;
+    std::string upgraded_host;
+
+    // Cargas bloqueadas por el filtro de contenido (aprox., ver BLOCK_COUNT_JS)
+    size_t blocked_page  = 0;
+    size_t blocked_total = 0;
+
+    ~TabData() {
+        if (session)  webkit_web_view_session_state_unref(session);
+        if (snapshot) g_object_unref(snapshot);
+    }
+};
+
+static GQuark tab_quark() {
+    static GQuark q = g_quark_from_static_string("prektbr-tab");
+    return q;
+}
+
+static void tab_attach(TabData* t, WebKitWebView* wview) {
+    t->webview = wview;
+    g_object_set_qdata(G_OBJECT(wview), tab_quark(), t);
+}
+
+// El WebView sale de la pestaña (cierre o cambio de modo): sus señales
+// posteriores ya no llegan a ningún TabData.
+static void tab_detach(WebKitWebView* wview) {
+    g_object_set_qdata(G_OBJECT(wview), tab_quark(), nullptr);
+}
+
+static TabData* tab_of(WebKitWebView* wview) {
+    return static_cast<TabData*>(g_object_get_qdata(G_OBJECT(wview), tab_quark()));
+}
+
+// Reduce una captura a max_w píxeles de ancho promediando bloques de
+// factor×factor (formato GDK_MEMORY_DEFAULT, 4 bytes por píxel).
+static GdkTexture* downscale_texture(GdkTexture* tex, int max_w) {
+    int w = gdk_texture_get_width(tex), h = gdk_texture_get_height(tex);
+    if (w <= 0 || h <= 0) return nullptr;
+    int factor = std::max(1, (w + max_w - 1) / max_w);
+    std::vector<guint8> src((size_t)w * h * 4);
+    gdk_texture_download(tex, src.data(), (size_t)w * 4);
+    int ow = std::max(1, w / factor), oh = std::max(1, h / factor);
+    guint8* dst = static_cast<guint8*>(g_malloc((size_t)ow * oh * 4));
+    for (int y = 0; y < oh; y++)
+        for (int x = 0; x < ow; x++)
+            for (int c = 0; c < 4; c++) {
+                unsigned sum = 0;
+                for (int dy = 0; dy < factor; dy++)
+                    for (int dx = 0; dx < factor; dx++)
+                        sum += src[(((size_t)(y * factor + dy) * w) + x * factor + dx) * 4 + c];
+                dst[((size_t)y * ow + x) * 4 + c] = (guint8)(sum / (factor * factor));
+            }
+    GBytes* bytes = g_bytes_new_take(dst, (size_t)ow * oh * 4);
+    GdkTexture* out = gdk_memory_texture_new(ow, oh, GDK_MEMORY_DEFAULT, bytes, (size_t)ow * 4);
+    g_bytes_unref(bytes);
+    return out;
+}
+
+// RSS total de los procesos WebKitWebProcess que descienden de este proceso
+// (0 si /proc no está disponible). WebKit no expone la memoria por vista, así
+// que el coste de cada pestaña se estima repartiendo este total.
+static size_t renderer_rss_bytes() {
+    struct Proc { long ppid; long rss; bool renderer; };
+    std::unordered_map<long, Proc> procs;
+    std::error_code ec;
+    for (auto& ent : std::filesystem::directory_iterator("/proc", ec)) {
+        const std::string name = ent.path().filename().string();
+        if (name.empty() || !isdigit((unsigned char)name[0])) continue;
+        std::ifstream f(ent.path() / "stat");
+        std::string line;
+        if (!std::getline(f, line)) continue;
+        size_t open = line.find('('), close = line.rfind(')');
+        if (open == std::string::npos || close == std::string::npos) continue;
+        std::istringstream rest(line.substr(close + 2));
+        std::vector<std::string> fields;
+        for (std::string tok; rest >> tok; ) fields.push_back(tok);
+        if (fields.size() < 22) continue;
+        // Tras el nombre: campo 3 (estado) en fields[0]; ppid = 4, rss = 24
+        Proc pr{std::atol(fields[1].c_str()), std::atol(fields[21].c_str()),
+                line.compare(open + 1, 15, "WebKitWebProces") == 0};
+        procs.emplace(std::atol(name.c_str()), pr);
+    }
+    std::unordered_map<long, std::vector<long>> children;
+    for (auto& [pid, pr] : procs) children[pr.ppid].push_back(pid);
+    size_t total = 0;
+    std::vector<long> stack{(long)getpid()};
+    while (!stack.empty()) {
+        long pid = stack.back();
+        stack.pop_back();
+        for (long child : children[pid]) {
+            if (procs[child].renderer) total += (size_t)procs[child].rss * (size_t)sysconf(_SC_PAGESIZE);
+            stack.push_back(child);
+        }
+    }
+    return total;
+}
+
+// ─── Sesión ───────────────────────────────────────────────────────────────────
+//
+// session.json guarda las pestañas en el orden de la barra:
+//   {"active": id, "tabs": [{id, mode, uri, title, state}]}
+// donde state es el WebKitWebViewSessionState serializado en base64. Cada
+// cambio posterior se añade a session.journal:
+//   {"op":"put", id, mode, uri, title, state}  (alta o actualización)
+//   {"op":"del", id}
+//   {"op":"active", id}
+// Las pestañas Tor/I2P solo guardan su modo: nunca URI, título ni estado.
+
+static void session_apply(json& session, const json& rec) {
+    if (!rec.is_object() || !session.is_object()) return;
+    if (!session.contains("tabs") || !session["tabs"].is_array()) session["tabs"] = json::array();
+    json& tabs = session["tabs"];
+    std::string op = rec.value("op", "");
+    uint32_t id = rec.value("id", 0u);
+    auto it = std::find_if(tabs.begin(), tabs.end(),
+                           [&](const json& t){ return t.value("id", 0u) == id; });
+    if (op == "put") {
+        json tab = rec;
+        tab.erase("op");
+        if (it != tabs.end()) *it = std::move(tab);
+        else                  tabs.push_back(std::move(tab));
+    } else if (op == "del") {
+        if (it != tabs.end()) tabs.erase(it);
+    } else if (op == "active") {
+        session["active"] = id;
+    }
+}
+
+// ─── Enrutado por host ────────────────────────────────────────────────────────
+//
+// Tabla de host → modo de red que se consulta antes de cada navegación. Las
+// reglas sin comodines (".onion", "ejemplo.org") cubren el host y todos sus
+// subdominios y se buscan por sufijo, de la etiqueta más larga a la más corta;
+// las que llevan '*' o '?' se compilan como GPatternSpec y se prueban después.
+// El valor "none" en config.json anula una regla por defecto.
+
+class HostRoutes {
+public:
+    HostRoutes() = default;
+    HostRoutes(const HostRoutes&) = delete;
+    HostRoutes& operator=(const HostRoutes&) = delete;
+    ~HostRoutes() { clear_patterns(); }
+
+    void compile(const json& overrides) {
+        suffixes_.clear();
+        clear_patterns();
+        json rules = {
+            {".onion", "tor"},
+            {".i2p",   "i2p"},
+            // Lokinet resuelve .loki a nivel de sistema (lokinet.service):
+            // pasar por el proxy de Tor o de I2P solo haría fallar la carga.
+            {".loki",  "normal"},
+        };
+        if (overrides.is_object()) rules.update(overrides);
+        for (auto& [key, val] : rules.items()) {
+            if (!val.is_string()) continue;
+            std::string mode = val.get<std::string>();
+            if (mode != "normal" && mode != "tor" && mode != "i2p") continue;
+            std::string host = str_tolower(str_trim(key));
+            if (host.find_first_of("*?") != std::string::npos) {
+                patterns_.push_back({g_pattern_spec_new(host.c_str()), host, mode});
+                continue;
+            }
+            while (!host.empty() && host[0] == '.') host.erase(0, 1);
+            if (!host.empty()) suffixes_[host] = mode;
+        }
+    }
+
+    // Modo al que debe ir el host, o nullptr si ninguna regla lo cubre
+    const std::string* route(const std::string& host_in) const {
+        if (host_in.empty()) return nullptr;
+        std::string host = str_tolower(host_in);
+        if (host.back() == '.') host.pop_back();
+        for (size_t p = 0; p != std::string::npos; ) {
+            auto it = suffixes_.find(host.c_str() + p);
+            if (it != suffixes_.end()) return &it->second;
+            p = host.find('.', p);
+            if (p != std::string::npos) p++;
+        }
+        for (auto& pt : patterns_)
+            if (g_pattern_spec_match_string(pt.spec, host.c_str())) return &pt.mode;
+        return nullptr;
+    }
+
+    std::vector<std::pair<std::string,std::string>> rules() const {
+        std::vector<std::pair<std::string,std::string>> out;
+        for (auto& [host, mode] : suffixes_) out.push_back({"." + host, mode});
+        std::sort(out.begin(), out.end());
+        for (auto& pt : patterns_) out.push_back({pt.text, pt.mode});
+        return out;
+    }
+
+private:
+    struct Pattern { GPatternSpec* spec; std::string text, mode; };
+
+    void clear_patterns() {
+        for (auto& pt : patterns_) g_pattern_spec_free(pt.spec);
+        patterns_.clear();
+    }
+
+    std::unordered_map<std::string, std::string> suffixes_;
+    std::vector<Pattern>                         patterns_;
+};
+
+// ─── Sondeo de proxies ────────────────────────────────────────────────────────
+//
+// Comprueba que el proxy local de cada modo privado responde: un saludo SOCKS5
+// (sin autenticación) contra Tor y un CONNECT HTTP contra I2P, cuya respuesta
+// sea cual sea (incluso un error) prueba que el proxy está vivo. El socket es
+// no bloqueante y cada paso espera con poll() hasta un plazo común, así que
+// probe_proxy nunca tarda más que timeout_ms; se llama desde un hilo aparte.
+
+struct ProxyEndpoint {
+    const char* mode;
+    const char* host;
+    int         port;
+    bool        socks; // SOCKS5; si no, proxy HTTP
+};
+
+static constexpr ProxyEndpoint PROXY_ENDPOINTS[] = {
+    {"tor", "127.0.0.1", 9050, true},
+    {"i2p", "127.0.0.1", 4444, false},
+};
+
+static const ProxyEndpoint* proxy_endpoint(const std::string& mode) {
+    for (auto& ep : PROXY_ENDPOINTS)
+        if (mode == ep.mode) return &ep;
+    return nullptr;
+}
+
+static std::string proxy_uri(const ProxyEndpoint& ep) {
+    return std::string(ep.socks ? "socks5://" : "http://") + ep.host + ":" + std::to_string(ep.port);
+}
+
+struct ProbeResult {
+    bool        ok = false;
+    double      ms = 0;      // ida y vuelta: conexión + saludo/respuesta
+    std::string error;
+    int64_t     at = 0;      // epoch
+};
+
+// Espera un evento en fd sin pasar del plazo (monotónico, en µs)
+static bool probe_wait(int fd, short events, int64_t deadline_us) {
+    for (;;) {
+        int64_t left = deadline_us - g_get_monotonic_time();
+        if (left <= 0) return false;
+        struct pollfd pfd = {fd, events, 0};
+        int r = poll(&pfd, 1, (int)std::max<int64_t>(1, left / 1000));
+        if (r > 0) return true;
+        if (r < 0 && errno != EINTR) return false;
+    }
+}
+
+static bool probe_send(int fd, const void* buf, size_t len, int64_t deadline_us) {
+    auto* p = static_cast<const uint8_t*>(buf);
+    while (len > 0) {
+        if (!probe_wait(fd, POLLOUT, deadline_us)) return false;
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) return false;
+        p += n; len -= (size_t)n;
+    }
+    return true;
+}
+
+// Lee hasta que done(buf) sea cierto, el par cierre la conexión o venza el plazo
+static bool probe_recv(int fd, std::string& buf, int64_t deadline_us,
+                       const std::function<bool(const std::string&)>& done) {
+    char chunk[256];
+    while (!done(buf)) {
+        if (!probe_wait(fd, POLLIN, deadline_us)) return false;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) return false;
+        buf.append(chunk, (size_t)n);
+        if (buf.size() > 4096) break;
+    }
+    return done(buf);
+}
+
+static ProbeResult probe_proxy(const ProxyEndpoint& ep, int timeout_ms) {
+    ProbeResult r;
+    r.at = now_epoch();
+    int64_t t0 = g_get_monotonic_time();
+    int64_t deadline = t0 + (int64_t)timeout_ms * 1000;
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons((uint16_t)ep.port);
+    if (inet_pton(AF_INET, ep.host, &addr.sin_addr) != 1) { r.error = "dirección inválida"; return r; }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { r.error = strerror(errno); return r; }
+
+    auto fail = [&](const std::string& why) { close(fd); r.error = why; return r; };
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        return fail(strerror(errno));
+    if (!probe_wait(fd, POLLOUT, deadline)) return fail("tiempo agotado al conectar");
+    int soerr = 0;
+    socklen_t slen = sizeof(soerr);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &soerr, &slen);
+    if (soerr) return fail(strerror(soerr));
+
+    std::string reply;
+    if (ep.socks) {
+        // Versión 5, un método: 0x00 (sin autenticación)
+        const uint8_t hello[] = {0x05, 0x01, 0x00};
+        if (!probe_send(fd, hello, sizeof(hello), deadline)) return fail("error al enviar el saludo SOCKS5");
+        if (!probe_recv(fd, reply, deadline, [](const std::string& b){ return b.size() >= 2; }))
+            return fail("sin respuesta SOCKS5");
+        if ((uint8_t)reply[0] != 0x05) return fail("la respuesta no es SOCKS5");
+        if ((uint8_t)reply[1] != 0x00) return fail("el proxy exige autenticación");
+    } else {
+        static const char req[] =
+            "CONNECT probe.invalid:443 HTTP/1.1\r\nHost: probe.invalid:443\r\n\r\n";
+        if (!probe_send(fd, req, sizeof(req) - 1, deadline)) return fail("error al enviar CONNECT");
+        if (!probe_recv(fd, reply, deadline, [](const std::string& b){ return b.find("\r\n") != std::string::npos; }))
+            return fail("sin respuesta HTTP");
+        if (reply.compare(0, 7, "HTTP/1.") != 0) return fail("la respuesta no es HTTP");
+    }
+    close(fd);
+    r.ok = true;
+    r.ms = (g_get_monotonic_time() - t0) / 1000.0;
+    return r;
+}
+
+// prektbr --probe-proxy <ip:puerto> socks|http [ms]
+// Sondea cualquier proxy con el mismo código que netstatus, por ejemplo un
+// listener local de prueba; sale con 0 si respondió.
+static int run_probe_proxy(int argc, char* argv[]) {
+    std::string target = argc > 2 ? argv[2] : "";
+    std::string kind   = argc > 3 ? argv[3] : "";
+    size_t colon = target.rfind(':');
+    int port = colon == std::string::npos ? 0 : atoi(target.c_str() + colon + 1);
+    int timeout_ms = argc > 4 ? atoi(argv[4]) : 3000;
+    if (port <= 0 || port > 65535 || timeout_ms <= 0 || (kind != "socks" && kind != "http")) {
+        std::cerr << "Uso: prektbr --probe-proxy <ip:puerto> socks|http [ms]\n";
+        return 2;
+    }
+    std::string host = target.substr(0, colon);
+    ProxyEndpoint ep{"prueba", host.c_str(), port, kind == "socks"};
+    ProbeResult r = probe_proxy(ep, timeout_ms);
+    if (r.ok) printf("%s: responde en %.1f ms\n", proxy_uri(ep).c_str(), r.ms);
+    else      printf("%s: %s\n", proxy_uri(ep).c_str(), r.error.c_str());
+    return r.ok ? 0 : 1;
+}
+
+// ─── Bloqueo de contenido ─────────────────────────────────────────────────────
+//
+// Convierte listas estilo EasyList a reglas de contenido de WebKit (JSON), que
+// después se compilan en un WebKitUserContentFilterStore. Solo se traduce lo
+// que WebKit puede expresar:
+//   ||host^  |inicio  fin|  *  ^      → trigger.url-filter (regex sin | ni {n})
+//   $third-party, $script, $image…    → load-type / resource-type
+//   $domain=a|~b                      → if-domain / unless-domain
+//   @@regla                           → ignore-previous-rules (van al final)
+//   dominios##selector                → css-display-none
+// Las reglas con opciones desconocidas, regex literales, excepciones de
+// ocultación (#@#) o filtros extendidos (#?#, #$#) se omiten y se cuentan.
+
+static constexpr size_t FILTER_MAX_RULES = 150000;
+
+struct FilterConversion {
+    json                            rules = json::array();
+    std::unordered_set<std::string> hosts;        // de reglas ||host^: para contar bloqueos
+    size_t                          unsupported = 0;
+};
+
+static bool filter_ascii(const std::string& s) {
+    for (unsigned char c : s) if (c >= 0x80) return false;
+    return true;
+}
+
+static std::string filter_pattern_regex(std::string p) {
+    std::string re;
+    if (p.compare(0, 2, "||") == 0) { re = "^[a-z][a-z0-9.+-]*://([^/:]*\\.)?"; p.erase(0, 2); }
+    else if (!p.empty() && p[0] == '|') { re = "^"; p.erase(0, 1); }
+    bool end_anchor = !p.empty() && p.back() == '|';
+    if (end_anchor) p.pop_back();
+    for (char c : p) {
+        switch (c) {
+        case '*': re += ".*"; break;
+        case '^': re += "[^a-zA-Z0-9_.%-]"; break;
+        case '.': case '+': case '?': case '(': case ')': case '[': case ']':
+        case '{': case '}': case '\\': case '$': case '|':
+            re += '\\'; re += c; break;
+        default:  re += c;
+        }
+    }
+    if (end_anchor) re += '$';
+    return re.empty() ? ".*" : re;
+}
+
+// "a.com,~b.com" (sep ',') o "a.com|~b.com" (sep '|'); falso si mezcla
+// dominios incluidos y excluidos, que WebKit no admite en un mismo trigger
+static bool filter_domains(const std::string& list, char sep, json& trigger) {
+    json inc = json::array(), exc = json::array();
+    std::stringstream ss(list);
+    std::string d;
+    while (std::getline(ss, d, sep)) {
+        d = str_tolower(str_trim(d));
+        bool neg = !d.empty() && d[0] == '~';
+        if (neg) d.erase(0, 1);
+        if (d.empty()) continue;
+        if (!filter_ascii(d) || d.find('*') != std::string::npos) return false;
+        (neg ? exc : inc).push_back("*" + d);
+    }
+    if (!inc.empty() && !exc.empty()) return false;
+    if (!inc.empty()) trigger["if-domain"]     = inc;
+    if (!exc.empty()) trigger["unless-domain"] = exc;
+    return true;
+}
+
+static FilterConversion convert_filter_list(std::istream& in) {
+    static const std::map<std::string, std::string> types = {
+        {"script", "script"}, {"image", "image"}, {"stylesheet", "style-sheet"}, {"css", "style-sheet"},
+        {"font", "font"}, {"media", "media"}, {"object", "media"}, {"xmlhttprequest", "raw"},
+        {"xhr", "raw"}, {"subdocument", "document"}, {"frame", "document"}, {"popup", "popup"},
+        {"ping", "ping"}, {"websocket", "websocket"}, {"other", "other"},
+    };
+    static const std::regex host_rule(R"(^\|\|([a-z0-9.-]+)\^$)");
+
+    FilterConversion out;
+    std::vector<json> exceptions;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = str_trim(line);
+        if (line.empty() || line[0] == '!' || line[0] == '[') continue;
+        if (out.rules.size() + exceptions.size() >= FILTER_MAX_RULES) { out.unsupported++; continue; }
+
+        // Ocultación de elementos
+        size_t hh = line.find("##");
+        if (hh != std::string::npos || line.find("#@#") != std::string::npos ||
+            line.find("#?#") != std::string::npos || line.find("#$#") != std::string::npos) {
+            std::string sel = hh != std::string::npos ? line.substr(hh + 2) : "";
+            json trigger = {{"url-filter", ".*"}};
+            if (sel.empty() || sel.compare(0, 1, "+") == 0 || !filter_ascii(sel) ||
+                sel.find(":-abp-") != std::string::npos ||
+                !filter_domains(line.substr(0, hh), ',', trigger)) {
+                out.unsupported++;
+                continue;
+            }
+            out.rules.push_back({{"trigger", trigger},
+                                 {"action", {{"type", "css-display-none"}, {"selector", sel}}}});
+            continue;
+        }
+
+        // Reglas de red
+        bool exception = line.compare(0, 2, "@@") == 0;
+        if (exception) line.erase(0, 2);
+        std::string pattern = line, opts;
+        size_t dollar = line.rfind('$');
+        if (dollar != std::string::npos && line.find('/', dollar) == std::string::npos) {
+            pattern = line.substr(0, dollar);
+            opts    = line.substr(dollar + 1);
+        }
+        if ((pattern.size() > 1 && pattern.front() == '/' && pattern.back() == '/') || !filter_ascii(pattern)) {
+            out.unsupported++;
+            continue;
+        }
+
+        json trigger = json::object();
+        std::set<std::string> pos, neg;
+        bool ok = true, document = false, only_types = true;
+        std::stringstream os(opts);
+        std::string o;
+        while (ok && std::getline(os, o, ',')) {
+            o = str_tolower(str_trim(o));
+            bool negated = !o.empty() && o[0] == '~';
+            std::string name = negated ? o.substr(1) : o;
+            if (o.empty() || o == "important") continue;
+            if (name == "third-party" || name == "3p") {
+                trigger["load-type"] = {negated ? "first-party" : "third-party"};
+            } else if (name == "first-party" || name == "1p") {
+                trigger["load-type"] = {negated ? "third-party" : "first-party"};
+            } else if (o == "match-case") {
+                trigger["url-filter-is-case-sensitive"] = true;
+            } else if (o.compare(0, 7, "domain=") == 0) {
+                ok = filter_domains(o.substr(7), '|', trigger);
+                only_types = false;
+            } else if (o == "document" || o == "doc") {
+                document = true;
+            } else if (types.count(name)) {
+                (negated ? neg : pos).insert(types.at(name));
+            } else {
+                ok = false;
+            }
+        }
+        if (!ok) { out.unsupported++; continue; }
+
+        // @@||host^$document: página permitida entera
+        std::smatch m;
+        if (document && exception) {
+            if (!std::regex_match(pattern, m, host_rule)) { out.unsupported++; continue; }
+            exceptions.push_back({{"trigger", {{"url-filter", ".*"}, {"if-domain", {"*" + m[1].str()}}}},
+                                  {"action", {{"type", "ignore-previous-rules"}}}});
+            continue;
+        }
+        if (document) pos.insert("document");
+        if (!neg.empty()) {
+            // Como en Adblock, "todos los tipos" no incluye documentos ni popups
+            if (pos.empty())
+                for (auto& [k, v] : types)
+                    if (v != "document" && v != "popup") pos.insert(v);
+            for (auto& n : neg) pos.erase(n);
+            if (pos.empty()) { out.unsupported++; continue; }
+        }
+        if (!pos.empty()) trigger["resource-type"] = std::vector<std::string>(pos.begin(), pos.end());
+        trigger["url-filter"] = filter_pattern_regex(pattern);
+
+        json rule = {{"trigger", trigger},
+                     {"action", {{"type", exception ? "ignore-previous-rules" : "block"}}}};
+        if (exception) {
+            exceptions.push_back(std::move(rule));
+        } else {
+            out.rules.push_back(std::move(rule));
+            if (only_types && std::regex_match(pattern, m, host_rule)) out.hosts.insert(m[1].str());
+        }
+    }
+    for (auto& e : exceptions) out.rules.push_back(std::move(e));
+    return out;
+}
+
+// Host o alguno de sus dominios padre tiene una regla ||host^
+static bool filter_host_blocked(const std::unordered_set<std::string>& hosts, const std::string& host) {
+    if (hosts.empty()) return false;
+    for (size_t p = 0; p != std::string::npos; ) {
+        if (hosts.count(host.substr(p))) return true;
+        p = host.find('.', p);
+        if (p != std::string::npos) p++;
+    }
+    return false;
+}
+
+// WebKit no avisa de las cargas que bloquea un filtro: se cuentan los
+// elementos cuya carga falla y cuyo host está en la lista (aproximación que
+// deja fuera fetch/XHR). Los hosts llegan en lotes a "prektBlocked", que,
+// como "prektOrigins", solo existe en PREKT_WORLD para que la página no pueda
+// inflar los contadores.
+static const char* BLOCK_COUNT_JS = R"js(
+(function() {
+    'use strict';
+    const h = window.webkit && window.webkit.messageHandlers && window.webkit.messageHandlers.prektBlocked;
+    if (!h) return;
+    let pending = [], timer = 0;
+    const flush = () => { timer = 0; if (pending.length) h.postMessage(pending.join(' ')); pending = []; };
+    window.addEventListener('error', e => {
+        const el = e.target;
+        const url = el && el !== window && (el.currentSrc || el.src || el.href);
+        if (typeof url !== 'string' || !url) return;
+        try { pending.push(new URL(url, location.href).hostname); } catch (err) { return; }
+        if (!timer) timer = setTimeout(flush, 500);
+    }, true);
+})();
+)js";
+
+// ─── Lista de hosts bloqueados ────────────────────────────────────────────────
+//
+// Listas de tipo hosts con millones de dominios, precompiladas con
+// `prektbr --compile-hosts` y abiertas con mmap: arrancar solo cuesta validar
+// la cabecera y las páginas se comparten entre procesos. hosts.bin:
+//   cabecera (16 B): "PKHB" | versión u32 | n u64
+//   cubos:           (HOSTS_BUCKETS + 1) × u32, inicio de cada cubo, y 4 B de
+//                    relleno para que los hashes queden alineados a 8
+//   hashes:          n × u64 ordenados
+// Los 16 bits altos del hash eligen el cubo y la búsqueda binaria dentro de él
+// recorre unas pocas entradas. Un dominio bloquea también sus subdominios.
+
+static constexpr uint32_t HOSTS_VERSION = 1;
+static constexpr size_t   HOSTS_BUCKETS = 1 << 16;
+static constexpr size_t   HOSTS_HEADER  = 16;
+static constexpr size_t   HOSTS_HASHES_AT = HOSTS_HEADER + (HOSTS_BUCKETS + 2) * 4;
+
+// FNV-1a con mezcla final (splitmix64) para que los bits altos repartan bien
+static uint64_t host_hash(const char* s, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) { h ^= (unsigned char)s[i]; h *= 0x100000001b3ULL; }
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+class HostBlocklist {
+public:
+    HostBlocklist() = default;
+    HostBlocklist(const HostBlocklist&) = delete;
+    HostBlocklist& operator=(const HostBlocklist&) = delete;
+    ~HostBlocklist() { close(); }
+
+    bool open(const std::string& path, std::string* error = nullptr) {
+        close();
+        auto fail = [&](const std::string& why) { if (error) *error = why; close(); return false; };
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return fail(strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < HOSTS_HEADER) { ::close(fd); return fail("archivo truncado"); }
+        void* map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) return fail(strerror(errno));
+        map_ = static_cast<const uint8_t*>(map);
+        len_ = (size_t)st.st_size;
+
+        uint32_t version;
+        uint64_t n;
+        memcpy(&version, map_ + 4, 4);
+        memcpy(&n, map_ + 8, 8);
+        if (memcmp(map_, "PKHB", 4) != 0 || version != HOSTS_VERSION) return fail("formato desconocido");
+        if (len_ != HOSTS_HASHES_AT + n * 8) return fail("tamaño incorrecto");
+        buckets_ = reinterpret_cast<const uint32_t*>(map_ + HOSTS_HEADER);
+        hashes_  = reinterpret_cast<const uint64_t*>(map_ + HOSTS_HASHES_AT);
+        if (buckets_[HOSTS_BUCKETS] != n) return fail("índice de cubos dañado");
+        n_ = n;
+        madvise(const_cast<uint8_t*>(map_), len_, MADV_RANDOM);
+        return true;
+    }
+
+    void close() {
+        if (map_) munmap(const_cast<uint8_t*>(map_), len_);
+        map_ = nullptr; len_ = 0; n_ = 0;
+        buckets_ = nullptr; hashes_ = nullptr;
+    }
+
+    bool   loaded() const { return map_ != nullptr; }
+    size_t size()   const { return n_; }
+    size_t bytes()  const { return len_; }
+
+    // El host o alguno de sus dominios padre está en la lista
+    bool blocked(const std::string& host) const {
+        if (!n_ || host.empty()) return false;
+        const char* s = host.c_str();
+        size_t n = host.size();
+        if (s[n - 1] == '.') n--;
+        for (size_t p = 0; p < n; ) {
+            if (contains(host_hash(s + p, n - p))) return true;
+            const void* dot = memchr(s + p, '.', n - p);
+            if (!dot) break;
+            p = (size_t)(static_cast<const char*>(dot) - s) + 1;
+        }
+        return false;
+    }
+
+private:
+    bool contains(uint64_t h) const {
+        size_t b = (size_t)(h >> 48);
+        return std::binary_search(hashes_ + buckets_[b], hashes_ + buckets_[b + 1], h);
+    }
+
+    const uint8_t*  map_     = nullptr;
+    size_t          len_     = 0;
+    uint64_t        n_       = 0;
+    const uint32_t* buckets_ = nullptr;
+    const uint64_t* hashes_  = nullptr;
+};
+
+// Una línea de lista: "0.0.0.0 dominio…" (formato hosts, con uno o varios
+// nombres tras la IP), "dominio" o "||dominio^"; comentarios con '#' o '!'.
+// Devuelve los dominios normalizados de la línea.
+static std::vector<std::string> hosts_line_domains(std::string line) {
+    std::vector<std::string> out;
+    size_t hash = line.find_first_of("#!");
+    if (hash != std::string::npos) line.resize(hash);
+    std::istringstream in(line);
+    std::string d;
+    bool first = true;
+    while (in >> d) {
+        if (first) {
+            first = false;
+            unsigned char ip[16];
+            if (inet_pton(AF_INET, d.c_str(), ip) == 1 || inet_pton(AF_INET6, d.c_str(), ip) == 1) continue;
+        }
+        if (d.compare(0, 2, "||") == 0) d.erase(0, 2);
+        if (!d.empty() && d.back() == '^') d.pop_back();
+        if (!d.empty() && d.back() == '.') d.pop_back();
+        d = str_tolower(d);
+        if (d.empty() || d == "localhost" || d == "localhost.localdomain" || d == "broadcasthost" ||
+            d == "local" || d.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789.-_") != std::string::npos)
+            continue;
+        out.push_back(std::move(d));
+    }
+    return out;
+}
+
+// prektbr --compile-hosts <lista>... <salida>
+static int run_compile_hosts(int argc, char* argv[]) {
+    if (argc < 4) {
+        std::cerr << "Uso: prektbr --compile-hosts <lista>... <salida.bin>\n";
+        return 2;
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<uint64_t> hashes;
+    size_t lines = 0;
+    for (int i = 2; i < argc - 1; i++) {
+        std::ifstream fin(argv[i]);
+        if (!fin) { std::cerr << "No se puede leer " << argv[i] << "\n"; return 1; }
+        std::string line;
+        while (std::getline(fin, line)) {
+            lines++;
+            for (auto& d : hosts_line_domains(line)) hashes.push_back(host_hash(d.data(), d.size()));
+        }
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    if (hashes.size() > UINT32_MAX) { std::cerr << "Demasiados dominios\n"; return 1; }
+
+    std::vector<uint32_t> buckets(HOSTS_BUCKETS + 2, 0); // el último es relleno
+    for (uint64_t h : hashes) buckets[(h >> 48) + 1]++;
+    for (size_t b = 1; b <= HOSTS_BUCKETS; b++) buckets[b] += buckets[b - 1];
+
+    std::string out = argv[argc - 1], tmp = out + ".tmp";
+    {
+        std::ofstream fout(tmp, std::ios::binary | std::ios::trunc);
+        uint64_t n = hashes.size();
+        fout.write("PKHB", 4);
+        fout.write(reinterpret_cast<const char*>(&HOSTS_VERSION), 4);
+        fout.write(reinterpret_cast<const char*>(&n), 8);
+        fout.write(reinterpret_cast<const char*>(buckets.data()), buckets.size() * 4);
+        fout.write(reinterpret_cast<const char*>(hashes.data()), hashes.size() * 8);
+        if (!fout) { std::cerr << "Error al escribir " << tmp << "\n"; return 1; }
+    }
+    if (rename(tmp.c_str(), out.c_str()) != 0) { std::cerr << "Error al renombrar a " << out << "\n"; return 1; }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << lines << " líneas → " << hashes.size() << " dominios en " << out
+              << " (" << (HOSTS_HASHES_AT + hashes.size() * 8) / 1024 << " KB, "
+              << (long)ms << " ms)\n";
+    return 0;
+}
+
+// ─── Mejora a HTTPS ───────────────────────────────────────────────────────────
+//
+// Hosts a los que una navegación http:// se reescribe a https:// antes de
+// enviarla, ahorrando la ida y vuelta de la redirección. Dos fuentes:
+//   - una tabla precargada estilo HSTS (TLD con HSTS obligatorio y unos pocos
+//     sitios grandes con includeSubDomains), que cubre también subdominios;
+//   - los hosts que se han visto redirigir de http a https (aprendidos, solo
+//     el host exacto), guardados cifrados en upgrades.json.
+// Los hosts .onion/.i2p/.loki, las IP y los nombres sin punto nunca se tocan.
+
+class HttpsUpgrades {
+public:
+    static constexpr size_t LEARNED_MAX = 10000;
+
+    HttpsUpgrades() {
+        static const char* const preload[] = {
+            // TLD con HSTS precargado por el registro
+            "app", "dev", "page", "new", "day", "foo", "zip", "mov", "phd", "prof", "esq",
+            "nexus", "ing", "meme", "boo", "rsvp", "dad", "channel", "how", "soy", "bank",
+            "insurance",
+            // Sitios con includeSubDomains
+            "google.com", "youtube.com", "gmail.com", "wikipedia.org", "wikimedia.org",
+            "wiktionary.org", "github.com", "githubusercontent.com", "gitlab.com",
+            "twitter.com", "x.com", "facebook.com", "instagram.com", "whatsapp.com",
+            "paypal.com", "dropbox.com", "duckduckgo.com", "torproject.org", "mozilla.org",
+            "stackoverflow.com", "reddit.com",
+        };
+        for (const char* d : preload) preload_.insert(d);
+    }
+
+    static bool exempt(const std::string& host) {
+        auto ends = [&](const char* suf) {
+            size_t n = strlen(suf);
+            return host.size() >= n && host.compare(host.size() - n, n, suf) == 0;
+        };
+        if (host.find('.') == std::string::npos || host.find(':') != std::string::npos) return true;
+        if (ends(".onion") || ends(".i2p") || ends(".loki")) return true;
+        struct in_addr a;
+        return inet_pton(AF_INET, host.c_str(), &a) == 1;
+    }
+
+    bool should_upgrade(const std::string& host) const {
+        if (exempt(host)) return false;
+        if (learned_.count(host)) return true;
+        for (size_t p = 0; p != std::string::npos; ) {
+            if (preload_.count(host.substr(p))) return true;
+            p = host.find('.', p);
+            if (p != std::string::npos) p++;
+        }
+        return false;
+    }
+
+    // Devuelve si el host es nuevo (hay que guardar)
+    bool learn(const std::string& host) {
+        if (exempt(host) || learned_.size() >= LEARNED_MAX) return false;
+        return learned_.insert(host).second;
+    }
+    bool forget(const std::string& host) { return learned_.erase(host) > 0; }
+
+    size_t learned() const { return learned_.size(); }
+    size_t preloaded() const { return preload_.size(); }
 
-struct TabData {
-    WebKitWebView* webview;
-    std::string    mode; // "normal" | "tor" | "i2p"
-    GtkWidget*     tab_widget;  // el Box de pestaña en la barra
-    GtkButton*     title_btn;   // botón de título dentro del tab_widget
+    json to_json() const { return json(std::vector<std::string>(learned_.begin(), learned_.end())); }
+    void load_json(const json& j) {
+        learned_.clear();
+        if (!j.is_array()) return;
+        for (auto& h : j)
+            if (h.is_string() && learned_.size() < LEARNED_MAX) learned_.insert(h.get<std::string>());
+    }
+
+private:
+    std::unordered_set<std::string> preload_;
+    std::set<std::string>           learned_;
 };
 
 // ─── Aplicación principal ─────────────────────────────────────────────────────
@@ -1082,68 +4277,574 @@ struct PrekTBR {
     std::string     home_uri;
     std::string     initial_url;
     bool            dark_mode = false;
-    json            history;
-    json            bookmarks;
+    HistoryStore    history{history_capacity()};
+    BookmarkStore   bookmarks;
+    SearchIndex     search_index;
+    HttpsUpgrades   https_upgrades;
+
+    // Registros en cada diario desde el último snapshot
+    int             journal_records = 0;
+    int             bookmark_journal_records = 0;
+
+    // Carga asíncrona: PBKDF2 + descifrado corren en store_loader; mientras
+    // tanto las visitas y cambios de marcadores se encolan en pending_ops.
+    bool                               store_ready = false;
+    std::thread                        store_loader;
+    std::vector<std::function<void()>> pending_ops;
+    std::vector<std::function<void()>> on_store_ready;
+    std::string                        last_pending_url;
+
+    // Cambios en el almacén ya cargado, para que las vistas se actualicen
+    // por posición en lugar de reconstruirse.
+    struct StoreChange {
+        enum Kind { HistoryPush, BookmarkPut, BookmarkDel, Reset } kind;
+        long slot    = -1;    // hueco del marcador afectado
+        bool evicted = false; // HistoryPush expulsó la visita más antigua
+        bool added   = false; // BookmarkPut creó un marcador nuevo
+    };
+    std::vector<std::function<void(const StoreChange&)>> on_store_change;
+    HistoryStore                       loaded_history{history_capacity()};
+    BookmarkStore                      loaded_bookmarks;
+    SearchIndex                        loaded_index;
+    HttpsUpgrades                      loaded_upgrades;
+    int                                loaded_journal_records = 0;
+
+    // Sesión de la ejecución anterior; restore_session() la consume
+    json                               session = json::object();
+    json                               loaded_session;
+
+    static constexpr int HISTORY_MAX           = 2000;
+    static constexpr int HISTORY_COMPACT_EVERY = 256;
+    static constexpr int BOOKMARK_COMPACT_EVERY = 256;
+
+    // config.json: "history_max" (visitas guardadas, por defecto HISTORY_MAX)
+    static size_t history_capacity() {
+        return (size_t)std::clamp(cfg("history_max", (long)HISTORY_MAX), 100L, 1000000L);
+    }
 
     PrekTBR() {
         char cwd[4096] = {};
         getcwd(cwd, sizeof(cwd));
         home_uri    = "file://" + std::string(cwd) + "/newtab.html";
         initial_url = home_uri;
-        history     = load_json_file(g_history_file,   json::array());
-        bookmarks   = load_json_file(g_bookmarks_file, json::array());
+    }
+
+    // Deriva la clave y descifra el almacén en un hilo; el resultado se
+    // instala en el hilo principal desde un idle.
+    void start_loading() {
+        store_loader = std::thread([this]{
+            auto t0 = std::chrono::steady_clock::now();
+            g_key            = load_or_derive_key(&g_startup.key_source);
+            auto t1 = std::chrono::steady_clock::now();
+            loaded_history.load_json(load_json_file(g_history_file, json::array(),
+                                                    loaded_history.capacity()));
+            auto history_records = journal_replay(g_history_journal);
+            replay_history_journal(loaded_history, history_records);
+            loaded_journal_records = (int)history_records.size();
+            loaded_bookmarks.load_json(load_json_file(g_bookmarks_file, json::array()));
+            auto bookmark_records = journal_replay(g_bookmarks_journal);
+            for (auto& r : bookmark_records) loaded_bookmarks.apply(r);
+            bookmark_journal_records = (int)bookmark_records.size();
+            std::string index_bytes;
+            if (load_blob_file(g_search_index_file, index_bytes)) loaded_index.deserialize(index_bytes);
+            loaded_session = load_json_file(g_session_file, json::object());
+            loaded_upgrades.load_json(load_json_file(g_upgrades_file, json::array()));
+            for (auto& r : journal_replay(g_session_journal)) session_apply(loaded_session, r);
+            loaded_index.reconcile(loaded_history, loaded_bookmarks);
+            auto t2 = std::chrono::steady_clock::now();
+            g_startup.key_ms   = std::chrono::duration<double, std::milli>(t1 - t0).count();
+            g_startup.store_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+            g_idle_add([](gpointer d) -> gboolean {
+                static_cast<PrekTBR*>(d)->finish_loading();
+                return G_SOURCE_REMOVE;
+            }, this);
+        });
+    }
+
+    void finish_loading() {
+        if (store_ready) return;
+        if (store_loader.joinable()) store_loader.join();
+        history      = std::move(loaded_history);
+        bookmarks    = std::move(loaded_bookmarks);
+        search_index = std::move(loaded_index);
+        session      = std::move(loaded_session);
+        https_upgrades = std::move(loaded_upgrades);
+        if (loaded_journal_records > 0)   compact_history();
+        if (bookmark_journal_records > 0) compact_bookmarks();
+        store_ready = true;
+        for (auto& op : pending_ops) op();
+        pending_ops.clear();
+        for (auto& cb : on_store_ready) cb();
+        g_startup.ready_ms = g_startup.since_start();
+        g_startup.report();
+    }
+
+    // Al salir antes de que termine la carga: esperar y aplicar lo encolado
+    // para no perder visitas ni marcadores.
+    void wait_ready() {
+        if (!store_ready && store_loader.joinable()) finish_loading();
+    }
+
+    // Snapshot + diario. Si la app se cerró entre escribir el snapshot y
+    // borrar el diario, los registros repetidos se descartan por (ts, url).
+    static void replay_history_journal(HistoryStore& history, const std::vector<json>& records) {
+        if (records.empty()) return;
+        std::set<std::pair<int64_t, std::string>> seen;
+        for (size_t i = 0; i < history.size(); i++) {
+            auto h = history.at(i);
+            seen.emplace(h.ts, std::string(h.url));
+        }
+        for (auto& r : records) {
+            if (!r.is_object() || !r.contains("url") || !r["url"].is_string()) continue;
+            std::string url = r["url"];
+            int64_t ts = json_ts(r.value("ts", json()));
+            if (seen.count({ts, url})) continue;
+            history.push(url, r.value("title", url), ts);
+        }
+    }
+
+    void compact_history() {
+        g_persist.compact(g_history_file, history.to_json(), g_history_journal);
+        journal_records = 0;
+    }
+
+    // El índice solo se guarda al salir y tras importar: si falta o quedó
+    // atrasado, reconcile() lo pone al día al arrancar.
+    void save_search_index() {
+        if (!store_ready || !search_index.dirty()) return;
+        g_persist.save_blob(g_search_index_file, search_index.serialize());
+        search_index.mark_clean();
+    }
+
+    // Host visto redirigiendo de http a https
+    void learn_https(const std::string& host) {
+        if (!store_ready) {
+            pending_ops.push_back([this, host]{ learn_https(host); });
+            return;
+        }
+        if (https_upgrades.learn(host))
+            g_persist.save_snapshot(g_upgrades_file, https_upgrades.to_json());
+    }
+
+    void forget_https(const std::string& host) {
+        if (!store_ready) {
+            pending_ops.push_back([this, host]{ forget_https(host); });
+            return;
+        }
+        if (https_upgrades.forget(host))
+            g_persist.save_snapshot(g_upgrades_file, https_upgrades.to_json());
     }
 
     void add_history(const std::string& url, const std::string& title_in = "") {
         if (url.empty() || url.substr(0,7) == "file://" || url == "about:blank") return;
         std::string title = title_in.empty() ? url : title_in;
-        if (!history.empty() && history.back()["url"] == url) return;
-        json entry;
-        entry["url"]   = url;
-        entry["title"] = title;
-        entry["ts"]    = now_iso();
-        history.push_back(entry);
-        if ((int)history.size() > 2000)
-            history = json(history.begin() + (history.size() - 2000), history.end());
-        save_json_file(g_history_file, history);
-    }
-
-    bool add_bookmark(const std::string& url, const std::string& title_in = "") {
-        if (url.empty() || url == "about:blank") return false;
-        for (auto& b : bookmarks)
-            if (b["url"] == url) return false;
-        json entry;
-        entry["url"]   = url;
-        entry["title"] = title_in.empty() ? url : title_in;
-        bookmarks.push_back(entry);
-        save_json_file(g_bookmarks_file, bookmarks);
-        return true;
+        int64_t ts = now_epoch();
+        if (!store_ready) {
+            if (last_pending_url == url) return;
+            last_pending_url = url;
+            pending_ops.push_back([this, url, title, ts]{ record_history(url, title, ts); });
+            return;
+        }
+        record_history(url, title, ts);
+    }
+
+    void notify(const StoreChange& c) {
+        for (auto& cb : on_store_change) cb(c);
+    }
+
+    void record_history(const std::string& url, const std::string& title, int64_t ts) {
+        if (!history.empty() && history.back().url == url) return;
+        bool evicted = history.size() == history.capacity();
+        if (evicted)
+            search_index.unvisit(std::string(history.at(0).url), history.at(0).ts);
+        history.push(url, title, ts);
+        search_index.visit(url, title, ts);
+        g_persist.append_journal(g_history_journal, HistoryStore::entry_json(history.back()));
+        if (++journal_records >= HISTORY_COMPACT_EVERY) compact_history();
+        StoreChange c{StoreChange::HistoryPush};
+        c.evicted = evicted;
+        notify(c);
+    }
+
+    void compact_bookmarks() {
+        g_persist.compact(g_bookmarks_file, bookmarks.to_json(), g_bookmarks_journal);
+        bookmark_journal_records = 0;
+    }
+
+    void log_bookmark(const json& record) {
+        g_persist.append_journal(g_bookmarks_journal, record);
+        if (++bookmark_journal_records >= BOOKMARK_COMPACT_EVERY) compact_bookmarks();
+    }
+
+    // Pending: los datos aún se cargan; se añadirá después si no existía ya
+    enum class BookmarkAdd { Added, Pending, Rejected };
+
+    BookmarkAdd add_bookmark(const std::string& url, const std::string& title_in = "") {
+        if (url.empty() || url == "about:blank") return BookmarkAdd::Rejected;
+        if (!store_ready) {
+            pending_ops.push_back([this, url, title_in]{ add_bookmark(url, title_in); });
+            return BookmarkAdd::Pending;
+        }
+        if (bookmarks.contains(url)) return BookmarkAdd::Rejected;
+        BookmarkStore::Bookmark b;
+        b.url   = url;
+        b.title = title_in.empty() ? url : title_in;
+        b.added = now_epoch();
+        log_bookmark(BookmarkStore::put_record(b));
+        search_index.set_bookmarked(b.url, b.title, true);
+        bookmarks.put(std::move(b));
+        StoreChange c{StoreChange::BookmarkPut, bookmarks.slot_of(url)};
+        c.added = true;
+        notify(c);
+        return BookmarkAdd::Added;
     }
 
     void remove_bookmark(const std::string& url) {
-        bookmarks.erase(
-            std::remove_if(bookmarks.begin(), bookmarks.end(),
-                [&](const json& b){ return b["url"] == url; }),
-            bookmarks.end()
-        );
-        save_json_file(g_bookmarks_file, bookmarks);
+        if (!store_ready) {
+            pending_ops.push_back([this, url]{ remove_bookmark(url); });
+            return;
+        }
+        long slot = bookmarks.slot_of(url);
+        if (bookmarks.remove(url)) {
+            log_bookmark(BookmarkStore::del_record(url));
+            search_index.set_bookmarked(url, "", false);
+            notify(StoreChange{StoreChange::BookmarkDel, slot});
+        }
+    }
+
+    // Cambia carpeta y/o etiquetas de un marcador existente
+    bool update_bookmark(const std::string& url, const std::string* folder,
+                         const std::vector<std::string>* tags) {
+        const BookmarkStore::Bookmark* cur = bookmarks.find(url);
+        if (!cur) return false;
+        BookmarkStore::Bookmark b = *cur;
+        if (folder) b.folder = *folder;
+        if (tags)   b.tags   = *tags;
+        log_bookmark(BookmarkStore::put_record(b));
+        bookmarks.put(std::move(b));
+        notify(StoreChange{StoreChange::BookmarkPut, bookmarks.slot_of(url)});
+        return true;
+    }
+
+    // Fusiona una importación: solo añade URLs nuevas y guarda un snapshot
+    // en lugar de un registro por marcador.
+    size_t import_bookmarks(std::vector<BookmarkStore::Bookmark>& items) {
+        size_t added = 0;
+        bookmarks.reserve(bookmarks.size() + items.size());
+        for (auto& b : items) {
+            if (bookmarks.contains(b.url)) continue;
+            if (!b.added) b.added = now_epoch();
+            search_index.set_bookmarked(b.url, b.title, true);
+            bookmarks.put(std::move(b));
+            added++;
+        }
+        if (added) {
+            compact_bookmarks();
+            save_search_index();
+            notify(StoreChange{StoreChange::Reset});
+        }
+        return added;
     }
 
     bool is_bookmarked(const std::string& url) {
-        for (auto& b : bookmarks)
-            if (b["url"] == url) return true;
-        return false;
+        return bookmarks.contains(url);
+    }
+};
+
+// ─── Modelo de la barra lateral ───────────────────────────────────────────────
+//
+// GListModel virtual sobre el almacén: no copia el historial ni los marcadores.
+// GtkListView solo pide las filas visibles y get_item() crea para cada una un
+// SidebarRow con el texto ya formateado. Cada StoreChange se traduce en un
+// items-changed sobre la posición afectada, así que la vista recicla sus
+// widgets en lugar de reconstruirse. El historial (más reciente primero) se
+// agrupa por fecha con GtkSectionModel; la búsqueda sí guarda una copia de
+// sus resultados, que están acotados.
+
+struct SidebarEntry {
+    std::string url;
+    std::string label;
+    bool        removable = false;
+};
+
+struct SidebarRow {
+    GObject       parent_instance;
+    SidebarEntry* entry;
+};
+
+static GObjectClass* sidebar_row_parent_class = nullptr;
+
+static GType sidebar_row_get_type() {
+    static GType type = 0;
+    if (type) return type;
+    type = g_type_register_static_simple(G_TYPE_OBJECT, "PrekSidebarRow", sizeof(GObjectClass),
+        [](gpointer klass, gpointer) {
+            sidebar_row_parent_class = G_OBJECT_CLASS(g_type_class_peek_parent(klass));
+            G_OBJECT_CLASS(klass)->finalize = [](GObject* obj) {
+                delete reinterpret_cast<SidebarRow*>(obj)->entry;
+                sidebar_row_parent_class->finalize(obj);
+            };
+        },
+        sizeof(SidebarRow), nullptr, (GTypeFlags)0);
+    return type;
+}
+
+static const SidebarEntry& sidebar_row_entry(gpointer row) {
+    return *static_cast<SidebarRow*>(row)->entry;
+}
+
+class SidebarFeed {
+public:
+    enum class Mode { History, Bookmarks, Search };
+
+    SidebarFeed(PrekTBR* app, GListModel* model) : app_(app), model_(model) {}
+
+    Mode   mode() const { return mode_; }
+    size_t size() const { return count_; }
+
+    // Cambia de fuente: query no vacía = resultados del índice de búsqueda
+    void reset(bool bookmarks, const std::string& query) {
+        size_t old = count_;
+        bookmarks_ = bookmarks;
+        query_     = query;
+        load();
+        g_list_model_items_changed(model_, 0, (guint)old, (guint)count_);
+    }
+
+    void apply(const PrekTBR::StoreChange& c) {
+        using K = PrekTBR::StoreChange;
+        if (c.kind != K::Reset && (c.kind != K::HistoryPush) != bookmarks_) return;
+        if (c.kind == K::Reset || mode_ == Mode::Search) {
+            reset(bookmarks_, query_);
+            return;
+        }
+        switch (c.kind) {
+        case K::HistoryPush:
+            // Con el anillo lleno primero sale la más antigua (al final de la
+            // lista); mientras tanto lead_ oculta la visita recién añadida.
+            if (c.evicted && count_ > 0) {
+                lead_ = 1;
+                count_--;
+                g_list_model_items_changed(model_, (guint)count_, 1, 0);
+                lead_ = 0;
+            }
+            count_++;
+            g_list_model_items_changed(model_, 0, 0, 1);
+            if (refresh_days())
+                gtk_section_model_sections_changed(GTK_SECTION_MODEL(model_), 0, (guint)count_);
+            break;
+        case K::BookmarkPut:
+            if (c.slot < 0) break;
+            if (c.added) {
+                slots_.push_back((uint32_t)c.slot);
+                count_++;
+                g_list_model_items_changed(model_, (guint)count_ - 1, 0, 1);
+            } else if (long pos = slot_pos(c.slot); pos >= 0) {
+                g_list_model_items_changed(model_, (guint)pos, 1, 1);
+            }
+            break;
+        case K::BookmarkDel:
+            if (long pos = slot_pos(c.slot); pos >= 0) {
+                slots_.erase(slots_.begin() + pos);
+                count_--;
+                g_list_model_items_changed(model_, (guint)pos, 1, 0);
+            }
+            // Compactar conserva el orden: las posiciones no cambian
+            if (gen_ != app_->bookmarks.generation()) load_slots();
+            break;
+        case K::Reset:
+            break;
+        }
+    }
+
+    SidebarEntry* entry(size_t pos) const {
+        auto* e = new SidebarEntry;
+        if (mode_ == Mode::History) {
+            auto h = app_->history.recent(pos + lead_);
+            e->url   = std::string(h.url);
+            e->label = format_ts(h.ts, h.ts >= yesterday_ ? "%H:%M" : "%Y-%m-%d") + "  ";
+            e->label += h.title.empty() ? h.url : h.title;
+        } else if (mode_ == Mode::Bookmarks) {
+            const auto& b = app_->bookmarks.slot(slots_[pos]);
+            e->url       = b.url;
+            e->label     = b.folder.empty() ? b.title : b.folder + " / " + b.title;
+            e->removable = true;
+        } else {
+            *e = hits_[pos];
+        }
+        return e;
+    }
+
+    // Secciones del historial: hoy, ayer y anteriores. Los cortes se buscan
+    // por bisección sobre los timestamps, que crecen con la posición en el anillo.
+    void section(size_t pos, guint* start, guint* end) const {
+        size_t cuts[4] = {0, 0, 0, count_};
+        if (mode_ == Mode::History) {
+            cuts[1] = cut(today_);
+            cuts[2] = std::max(cuts[1], cut(yesterday_));
+        }
+        int k = pos < cuts[1] ? 0 : pos < cuts[2] ? 1 : 2;
+        *start = (guint)cuts[k];
+        *end   = (guint)cuts[k + 1];
+    }
+
+    const char* section_label(size_t start) const {
+        if (start < cut(today_))     return "Hoy";
+        if (start < cut(yesterday_)) return "Ayer";
+        return "Anteriores";
+    }
+
+private:
+    void load() {
+        mode_ = !query_.empty() ? Mode::Search : bookmarks_ ? Mode::Bookmarks : Mode::History;
+        lead_ = 0;
+        slots_.clear();
+        hits_.clear();
+        if (mode_ == Mode::History) {
+            count_ = app_->history.size();
+            refresh_days();
+        } else if (mode_ == Mode::Bookmarks) {
+            load_slots();
+        } else {
+            auto hits = app_->search_index.search(query_, SEARCH_MAX,
+                bookmarks_ ? SearchIndex::Filter::Bookmarked : SearchIndex::Filter::Visited);
+            for (auto& h : hits) {
+                const auto& d = app_->search_index.doc(h.doc);
+                SidebarEntry e;
+                e.url       = d.url;
+                e.label     = bookmarks_ ? d.title : "[" + format_ts(d.last_ts, "%Y-%m-%d") + "] " + d.title;
+                e.removable = bookmarks_;
+                hits_.push_back(std::move(e));
+            }
+            count_ = hits_.size();
+        }
+    }
+
+    void load_slots() {
+        slots_.clear();
+        slots_.reserve(app_->bookmarks.size());
+        for (size_t i = 0; i < app_->bookmarks.slots(); i++)
+            if (app_->bookmarks.slot(i).live) slots_.push_back((uint32_t)i);
+        count_ = slots_.size();
+        gen_   = app_->bookmarks.generation();
+    }
+
+    long slot_pos(long slot) const {
+        auto it = std::lower_bound(slots_.begin(), slots_.end(), (uint32_t)slot);
+        return it != slots_.end() && *it == (uint32_t)slot ? (long)(it - slots_.begin()) : -1;
+    }
+
+    // Primera posición cuya visita es anterior a t
+    size_t cut(int64_t t) const {
+        size_t lo = 0, hi = count_;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (app_->history.recent(mid + lead_).ts >= t) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // Medianoche local de hoy y de ayer; true si cambió el día
+    bool refresh_days() {
+        std::time_t now = std::time(nullptr);
+        struct tm tmv = {};
+        localtime_r(&now, &tmv);
+        tmv.tm_hour = tmv.tm_min = tmv.tm_sec = 0;
+        tmv.tm_isdst = -1;
+        int64_t today = (int64_t)mktime(&tmv);
+        tmv.tm_mday -= 1;
+        tmv.tm_isdst = -1;
+        yesterday_ = (int64_t)mktime(&tmv);
+        bool changed = today != today_;
+        today_ = today;
+        return changed;
     }
+
+    static constexpr size_t SEARCH_MAX = 500;
+
+    PrekTBR*    app_;
+    GListModel* model_;
+    Mode        mode_      = Mode::History;
+    bool        bookmarks_ = false;
+    std::string query_;
+    size_t      count_     = 0;
+    size_t      lead_      = 0;
+    uint64_t    gen_       = 0;
+    int64_t     today_     = 0;
+    int64_t     yesterday_ = 0;
+
+    std::vector<uint32_t>     slots_;
+    std::vector<SidebarEntry> hits_;
+};
+
+struct SidebarModel {
+    GObject      parent_instance;
+    SidebarFeed* feed;
 };
 
+static GObjectClass* sidebar_model_parent_class = nullptr;
+
+static SidebarFeed* sidebar_feed_of(gpointer model) {
+    return static_cast<SidebarModel*>(model)->feed;
+}
+
+static GType sidebar_model_get_type() {
+    static GType type = 0;
+    if (type) return type;
+    type = g_type_register_static_simple(G_TYPE_OBJECT, "PrekSidebarModel", sizeof(GObjectClass),
+        [](gpointer klass, gpointer) {
+            sidebar_model_parent_class = G_OBJECT_CLASS(g_type_class_peek_parent(klass));
+            G_OBJECT_CLASS(klass)->finalize = [](GObject* obj) {
+                delete sidebar_feed_of(obj);
+                sidebar_model_parent_class->finalize(obj);
+            };
+        },
+        sizeof(SidebarModel), nullptr, (GTypeFlags)0);
+
+    static const GInterfaceInfo list_info = {
+        [](gpointer g_iface, gpointer) {
+            auto* iface = static_cast<GListModelInterface*>(g_iface);
+            iface->get_item_type = [](GListModel*) { return sidebar_row_get_type(); };
+            iface->get_n_items   = [](GListModel* m) { return (guint)sidebar_feed_of(m)->size(); };
+            iface->get_item      = [](GListModel* m, guint pos) -> gpointer {
+                SidebarFeed* feed = sidebar_feed_of(m);
+                if (pos >= feed->size()) return nullptr;
+                auto* row  = static_cast<SidebarRow*>(g_object_new(sidebar_row_get_type(), nullptr));
+                row->entry = feed->entry(pos);
+                return row;
+            };
+        }, nullptr, nullptr };
+    static const GInterfaceInfo section_info = {
+        [](gpointer g_iface, gpointer) {
+            static_cast<GtkSectionModelInterface*>(g_iface)->get_section =
+                [](GtkSectionModel* m, guint pos, guint* start, guint* end) {
+                    sidebar_feed_of(m)->section(pos, start, end);
+                };
+        }, nullptr, nullptr };
+    g_type_add_interface_static(type, G_TYPE_LIST_MODEL, &list_info);
+    g_type_add_interface_static(type, GTK_TYPE_SECTION_MODEL, &section_info);
+    return type;
+}
+
+static SidebarModel* sidebar_model_new(PrekTBR* app) {
+    auto* model = static_cast<SidebarModel*>(g_object_new(sidebar_model_get_type(), nullptr));
+    model->feed = new SidebarFeed(app, G_LIST_MODEL(model));
+    return model;
+}
+
 // ─── Ventana del navegador ────────────────────────────────────────────────────
 
 struct BrowserWindow {
     GtkApplicationWindow* window;
     PrekTBR*   app;
-    std::vector<TabData> tabs;
+    std::vector<std::unique_ptr<TabData>> tabs;
     int        current_tab = -1;
+    uint32_t   next_tab_id = 1;
+    bool       session_live    = false; // restaurada: cada cambio de pestaña va al diario
+    int        session_records = 0;
     std::string sidebar_mode; // "" | "bookmarks" | "history"
+    std::string sidebar_query;
     bool       inspector_mode              = false;
     bool       findbar_visible             = false;
     bool       terminal_visible            = false;
@@ -1161,7 +4862,12 @@ struct BrowserWindow {
     GtkWidget* sec_badge;
     GtkWidget* content_area;
     GtkWidget* sidebar_widget;
+    GtkWidget* sidebar_view  = nullptr;
+    GtkListItemFactory* sidebar_headers = nullptr; // referencia propia, vive con sidebar_view
+    GtkWidget* sidebar_empty = nullptr;
+    SidebarFeed* sidebar_feed = nullptr;
     GtkWidget* tab_stack;
+    HostRoutes routes; // host → modo de red, compilada en build_ui
 
     // Terminal
     GtkTextBuffer* terminal_buf;
@@ -1182,15 +4888,33 @@ struct BrowserWindow {
 
     // Statusbar
     GtkWidget* statusbar;
+
+    // Autocompletado de la barra de direcciones
+    GtkWidget*               suggest_popover = nullptr;
+    GtkWidget*               suggest_list    = nullptr;
+    std::vector<std::string> suggest_urls;
+    bool                     suggest_lock    = false;
+    static constexpr size_t  SUGGEST_MAX     = 8;
     GtkWidget* dl_progress;
 
     // ── Ayudantes ────────────────────────────────────────────────────────────
 
     WebKitWebView* wv() {
-        return tabs[current_tab].webview;
+        return tabs[current_tab]->webview;
     }
     TabData& td() {
-        return tabs[current_tab];
+        return *tabs[current_tab];
+    }
+
+    // Posición actual de la pestaña con ese id (-1 si ya se cerró)
+    int tab_pos(uint32_t id) const {
+        for (int i = 0; i < (int)tabs.size(); i++)
+            if (tabs[i]->id == id) return i;
+        return -1;
+    }
+
+    static std::string tab_name(const TabData& t) {
+        return "tab-" + std::to_string(t.id);
     }
 
     // ── Botón de navegación ──────────────────────────────────────────────────
@@ -1207,6 +4931,7 @@ struct BrowserWindow {
     // ── Construcción de la UI ─────────────────────────────────────────────────
 
     void build_ui() {
+        routes.compile(cfg("routes", json::object()));
         GtkWidget* root = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 
         // ── Barra de pestañas
@@ -1246,6 +4971,7 @@ struct BrowserWindow {
         g_signal_connect(url_entry, "activate", G_CALLBACK(+[](GtkEntry*, gpointer d){
             static_cast<BrowserWindow*>(d)->on_url_activate();
         }), this);
+        build_suggest_popover();
 
         badge = gtk_label_new("");
         gtk_widget_add_css_class(badge, "badge-normal");
@@ -1402,31 +5128,50 @@ struct BrowserWindow {
         }), this);
         gtk_widget_add_controller(GTK_WIDGET(window), key_global);
 
+        view_pool["normal"].warm = true;
+        schedule_pool_refill();
+
+        g_timeout_add_seconds(DISCARD_CHECK_S, [](gpointer d) -> gboolean {
+            static_cast<BrowserWindow*>(d)->discard_idle_tabs();
+            return G_SOURCE_CONTINUE;
+        }, this);
+
+        if (cfg("blocker", true)) load_content_filter();
+        open_hostlist();
+
+        long probe_s = cfg("proxy_probe_s", 30L);
+        if (probe_s > 0) {
+            g_timeout_add_seconds((guint)probe_s, [](gpointer d) -> gboolean {
+                static_cast<BrowserWindow*>(d)->probe_active_modes();
+                return G_SOURCE_CONTINUE;
+            }, this);
+        }
+
         term_print("PrekT-BR v2.1  —  escribe 'help' para ver los comandos");
         term_prompt();
     }
 
     // ── Pestaña: crear widget ────────────────────────────────────────────────
 
-    void make_tab_widget(int idx) {
+    // Los callbacks llevan el id de la pestaña, no su posición: abrir o
+    // cerrar otra pestaña no obliga a recrear ningún widget.
+    void make_tab_widget(TabData& t) {
         GtkWidget* tab_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
         gtk_widget_add_css_class(tab_box, "tab-btn");
 
-        char lbl[32];
-        snprintf(lbl, sizeof(lbl), "Tab %d", idx+1);
-        GtkWidget* title_btn = gtk_button_new_with_label(lbl);
+        // El id es interno (nombres del stack y callbacks): no se muestra
+        GtkWidget* title_btn = gtk_button_new_with_label("Nueva pestaña");
         gtk_widget_add_css_class(title_btn, "tab-title-btn");
         gtk_widget_set_hexpand(title_btn, TRUE);
 
-        // Usar índice capturado
-        using TabPair = std::pair<BrowserWindow*,int>;
-        static auto tab_cb      = +[](GtkButton*, gpointer d){ auto* p = static_cast<TabPair*>(d); p->first->switch_tab(p->second); };
-        static auto tab_close_cb= +[](GtkButton*, gpointer d){ auto* p = static_cast<TabPair*>(d); p->first->on_close_tab(p->second); };
-        static GClosureNotify tab_destroy = [](gpointer p, GClosure*){ delete static_cast<TabPair*>(p); };
+        using TabRef = std::pair<BrowserWindow*,uint32_t>;
+        static auto tab_cb      = +[](GtkButton*, gpointer d){ auto* p = static_cast<TabRef*>(d); p->first->switch_tab(p->first->tab_pos(p->second)); };
+        static auto tab_close_cb= +[](GtkButton*, gpointer d){ auto* p = static_cast<TabRef*>(d); int i = p->first->tab_pos(p->second); if (i >= 0) p->first->on_close_tab(i); };
+        static GClosureNotify tab_destroy = [](gpointer p, GClosure*){ delete static_cast<TabRef*>(p); };
 
         g_signal_connect_data(title_btn, "clicked",
             G_CALLBACK(tab_cb),
-            new TabPair(this, idx),
+            new TabRef(this, t.id),
             tab_destroy,
             G_CONNECT_DEFAULT);
 
@@ -1434,7 +5179,7 @@ struct BrowserWindow {
         gtk_widget_add_css_class(close_btn, "close-tab-btn");
         g_signal_connect_data(close_btn, "clicked",
             G_CALLBACK(tab_close_cb),
-            new TabPair(this, idx),
+            new TabRef(this, t.id),
             tab_destroy,
             G_CONNECT_DEFAULT);
 
@@ -1442,136 +5187,808 @@ struct BrowserWindow {
         gtk_box_append(GTK_BOX(tab_box), close_btn);
 
         // Guardar referencias en TabData
-        tabs[idx].tab_widget = tab_box;
-        tabs[idx].title_btn  = GTK_BUTTON(title_btn);
+        t.tab_widget = tab_box;
+        t.title_btn  = GTK_BUTTON(title_btn);
         gtk_box_append(GTK_BOX(tabbar_box), tab_box);
     }
 
     // ── Abrir pestaña ────────────────────────────────────────────────────────
 
     void open_tab(const std::string& uri = "", const std::string& mode = "normal") {
-        WebKitWebView* wview = make_webview(mode);
-        TabData new_td;
-        new_td.webview    = wview;
-        new_td.mode       = mode;
-        new_td.tab_widget = nullptr;
-        new_td.title_btn  = nullptr;
-        tabs.push_back(new_td);
+        WebKitWebView* wview = make_webview(mode, uri.empty() || uri == app->home_uri);
+        auto new_td  = std::make_unique<TabData>();
+        new_td->id   = next_tab_id++;
+        new_td->mode = mode;
+        new_td->last_uri = uri;
+        tab_attach(new_td.get(), wview);
+        tabs.push_back(std::move(new_td));
         int idx = (int)tabs.size() - 1;
 
-        char name[32];
-        snprintf(name, sizeof(name), "tab%d", idx);
-        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(wview), name);
+        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(wview), tab_name(*tabs[idx]).c_str());
 
-        make_tab_widget(idx);
+        make_tab_widget(*tabs[idx]);
         setup_download_handler(wview);
+        session_put(*tabs[idx]);
+        probe_mode(mode);
         switch_tab(idx);
-        webkit_web_view_load_uri(wview, uri.empty() ? app->home_uri.c_str() : uri.c_str());
+        // Las vistas de la reserva ya traen cargada la página de inicio
+        const char* loaded = webkit_web_view_get_uri(wview);
+        if (!uri.empty() || !loaded || app->home_uri != loaded)
+            webkit_web_view_load_uri(wview, uri.empty() ? app->home_uri.c_str() : uri.c_str());
     }
 
     // ── Cerrar pestaña ───────────────────────────────────────────────────────
 
     void on_close_tab(int idx) {
+        if (idx < 0 || idx >= (int)tabs.size()) return;
         if ((int)tabs.size() == 1) {
-            webkit_web_view_load_uri(tabs[0].webview, app->home_uri.c_str());
+            webkit_web_view_load_uri(tabs[0]->webview, app->home_uri.c_str());
+            return;
+        }
+        clear_tab_data(*tabs[idx]);
+        gtk_box_remove(GTK_BOX(tabbar_box), tabs[idx]->tab_widget);
+        log_session({{"op", "del"}, {"id", tabs[idx]->id}});
+        if (tabs[idx]->webview) tab_detach(tabs[idx]->webview);
+        gtk_stack_remove(GTK_STACK(tab_stack), tab_page(*tabs[idx]));
+        if (tabs[idx]->retiring) gtk_stack_remove(GTK_STACK(tab_stack), GTK_WIDGET(tabs[idx]->retiring));
+        std::string closed_mode = tabs[idx]->mode;
+        std::string retiring_mode = tabs[idx]->retiring ? tabs[idx]->retiring_mode : "";
+        tabs.erase(tabs.begin() + idx);
+        release_mode_session(closed_mode);
+        if (!retiring_mode.empty()) release_mode_session(retiring_mode);
+        if (idx == current_tab) {
+            current_tab = -1;
+            switch_tab(std::min(idx, (int)tabs.size() - 1));
+        } else if (idx < current_tab) {
+            current_tab--;
+        }
+    }
+
+    // Sesión de red de la pestaña, también si está descartada o restaurada sin
+    // cargar: las normales usan la sesión por defecto y las privadas sin vista
+    // solo pueden ser de la sesión compartida del modo (las de sesión propia
+    // no se descartan).
+    WebKitNetworkSession* tab_session(const TabData& t) {
+        if (t.webview) return webkit_web_view_get_network_session(t.webview);
+        if (t.mode == "normal") return webkit_network_session_get_default();
+        auto shared = mode_sessions.find(t.mode);
+        return shared != mode_sessions.end() ? shared->second.ns : nullptr;
+    }
+
+    // Borra los datos de los sitios que visitó la pestaña y que ninguna otra
+    // pestaña de la misma sesión de red tiene abiertos. Asíncrono: fetch para
+    // conocer qué hay guardado y remove solo de lo que coincide. La caché de
+    // disco se conserva salvo con clear_on_close "strict"; "all" recupera el
+    // borrado completo de la sesión.
+    void clear_tab_data(TabData& t) {
+        WebKitNetworkSession* ns = tab_session(t);
+        if (!ns) return;
+        // La sesión compartida de un modo se vacía con su última pestaña
+        auto shared = mode_sessions.find(t.mode);
+        if (shared != mode_sessions.end() && shared->second.ns == ns) return;
+        WebKitWebsiteDataManager* wdm = webkit_network_session_get_website_data_manager(ns);
+        if (!wdm) return;
+
+        std::string policy = cfg("clear_on_close", std::string("origins"));
+        if (policy == "all") { wipe_tab_data(t); return; }
+        int types = WEBKIT_WEBSITE_DATA_COOKIES |
+                    WEBKIT_WEBSITE_DATA_MEMORY_CACHE |
+                    WEBKIT_WEBSITE_DATA_SESSION_STORAGE |
+                    WEBKIT_WEBSITE_DATA_LOCAL_STORAGE |
+                    WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES |
+                    WEBKIT_WEBSITE_DATA_OFFLINE_APPLICATION_CACHE;
+        if (policy == "strict") types |= WEBKIT_WEBSITE_DATA_DISK_CACHE;
+
+        struct Scope {
+            WebKitWebsiteDataManager* wdm;
+            WebKitWebsiteDataTypes    types;
+            std::set<std::string>     drop, keep;
+        };
+        auto* scope = new Scope{WEBKIT_WEBSITE_DATA_MANAGER(g_object_ref(wdm)),
+                                (WebKitWebsiteDataTypes)types, t.origins, {}};
+        for (auto& o : tabs)
+            if (o.get() != &t && tab_session(*o) == ns)
+                scope->keep.insert(o->origins.begin(), o->origins.end());
+        if (scope->drop.empty()) { g_object_unref(scope->wdm); delete scope; return; }
+
+        webkit_website_data_manager_fetch(wdm, scope->types, nullptr,
+            [](GObject* src, GAsyncResult* res, gpointer d) {
+                auto* sc = static_cast<Scope*>(d);
+                GList* all = webkit_website_data_manager_fetch_finish(WEBKIT_WEBSITE_DATA_MANAGER(src), res, nullptr);
+                GList* hit = nullptr;
+                for (GList* l = all; l; l = l->next) {
+                    auto* wd = static_cast<WebKitWebsiteData*>(l->data);
+                    std::string name = webkit_website_data_get_name(wd);
+                    if (origin_matches(sc->drop, name) && !origin_matches(sc->keep, name))
+                        hit = g_list_prepend(hit, wd);
+                }
+                if (hit)
+                    webkit_website_data_manager_remove(sc->wdm, sc->types, hit, nullptr, nullptr, nullptr);
+                g_list_free(hit);
+                g_list_free_full(all, (GDestroyNotify)webkit_website_data_unref);
+                g_object_unref(sc->wdm);
+                delete sc;
+            }, scope);
+    }
+
+    // Borrado completo de la sesión de red de la pestaña (clearall)
+    void wipe_tab_data(TabData& t) {
+        WebKitNetworkSession* ns = tab_session(t);
+        if (!ns) return;
+        auto shared = mode_sessions.find(t.mode);
+        if (shared != mode_sessions.end() && shared->second.ns == ns) return;
+        WebKitWebsiteDataManager* wdm = webkit_network_session_get_website_data_manager(ns);
+        if (!wdm) return;
+        webkit_website_data_manager_clear(wdm,
+            (WebKitWebsiteDataTypes)(
+                WEBKIT_WEBSITE_DATA_COOKIES |
+                WEBKIT_WEBSITE_DATA_DISK_CACHE |
+                WEBKIT_WEBSITE_DATA_MEMORY_CACHE |
+                WEBKIT_WEBSITE_DATA_SESSION_STORAGE |
+                WEBKIT_WEBSITE_DATA_LOCAL_STORAGE |
+                WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES |
+                WEBKIT_WEBSITE_DATA_OFFLINE_APPLICATION_CACHE
+            ),
+            0, nullptr, nullptr, nullptr
+        );
+    }
+
+    void switch_tab(int idx) {
+        if (idx < 0 || idx >= (int)tabs.size()) return;
+
+        // Solo cambian de estilo la pestaña saliente y la entrante
+        int64_t now = g_get_monotonic_time();
+        if (current_tab >= 0 && current_tab < (int)tabs.size()) {
+            gtk_widget_remove_css_class(tabs[current_tab]->tab_widget, "tab-active");
+            tabs[current_tab]->last_active_us = now;
+        }
+        gtk_widget_add_css_class(tabs[idx]->tab_widget, "tab-active");
+        tabs[idx]->last_active_us = now;
+        if (!tabs[idx]->webview) restore_tab(*tabs[idx]);
+
+        current_tab = idx;
+        log_session({{"op", "active"}, {"id", tabs[idx]->id}});
+        gtk_stack_set_visible_child_name(GTK_STACK(tab_stack), tab_name(*tabs[idx]).c_str());
+
+        const char* uri = webkit_web_view_get_uri(tabs[idx]->webview);
+        if (uri && strcmp(uri, "about:blank") != 0)
+            set_url_text(uri);
+        else
+            set_url_text("");
+
+        update_badge(tabs[idx]->mode);
+        update_reload_button();
+        update_nav_buttons();
+        update_bookmark_star();
+        update_security_badge(uri ? uri : "");
+    }
+
+    // Abre y cierra n pestañas en blanco midiendo el coste de la barra de
+    // pestañas y del GtkStack (comando benchtabs).
+    void bench_tabs(int n) {
+        uint32_t origin = tabs[current_tab]->id;
+        std::vector<uint32_t> ids;
+        ids.reserve(n);
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            open_tab("about:blank");
+            ids.push_back(tabs[current_tab]->id);
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        // Cerrar alternando la del centro y la última que quedan
+        for (size_t k = 0; !ids.empty(); k++) {
+            size_t j = (k % 2 == 0) ? ids.size() / 2 : ids.size() - 1;
+            on_close_tab(tab_pos(ids[j]));
+            ids.erase(ids.begin() + j);
+        }
+        auto t2 = std::chrono::steady_clock::now();
+        switch_tab(tab_pos(origin));
+        double open_ms  = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        double close_ms = std::chrono::duration<double, std::milli>(t2 - t1).count();
+        char buf[200];
+        snprintf(buf, sizeof(buf), "  %d pestañas: abrir %.0f ms (%.2f ms/pestaña), cerrar %.0f ms (%.2f ms/pestaña)",
+                 n, open_ms, open_ms / n, close_ms, close_ms / n);
+        term_print(buf);
+    }
+
+    // ── Descarte de pestañas ─────────────────────────────────────────────────
+    //
+    // config.json: "discard_idle_min" (minutos sin usar una pestaña antes de
+    // descartarla, 0 = nunca) y "discard_budget_mb" (memoria estimada de todos
+    // los renderers; al superarla se descartan las menos usadas, 0 = sin
+    // límite). Una pestaña descartada guarda su WebKitWebViewSessionState y
+    // una captura reducida; su WebView se destruye y se recrea al volver.
+
+    static constexpr guint  DISCARD_CHECK_S  = 60;
+    static constexpr int    SNAPSHOT_MAX_W   = 480;
+    static constexpr double TAB_COST_GUESS_MB = 100;
+
+    static GtkWidget* tab_page(const TabData& t) {
+        return t.webview ? GTK_WIDGET(t.webview) : t.placeholder;
+    }
+
+    // Una pestaña Tor/I2P con sesión efímera propia no se descarta: al
+    // destruir la vista se perdería esa sesión (cookies, inicios de sesión) y
+    // la restauración volvería a pedir la página por el proxy en otra nueva.
+    bool can_discard(const TabData& t) {
+        if ((t.mode == "tor" || t.mode == "i2p") && !cfg("shared_private_session", false)) return false;
+        return t.webview && !t.discarding && !t.retiring && &t != &td()
+            && !webkit_web_view_is_playing_audio(t.webview);
+    }
+
+    // Memoria estimada por pestaña residente
+    double tab_cost_mb() {
+        size_t resident = 0;
+        for (auto& t : tabs) if (t->webview) resident++;
+        size_t rss = renderer_rss_bytes();
+        if (!rss || !resident) return TAB_COST_GUESS_MB;
+        return rss / 1048576.0 / resident;
+    }
+
+    // La captura es asíncrona; el WebView se destruye en finish_discard.
+    void discard_tab(TabData& t) {
+        if (!can_discard(t)) return;
+        t.discarding = true;
+        using TabRef = std::pair<BrowserWindow*,uint32_t>;
+        webkit_web_view_get_snapshot(t.webview, WEBKIT_SNAPSHOT_REGION_VISIBLE,
+            WEBKIT_SNAPSHOT_OPTIONS_NONE, nullptr,
+            [](GObject* src, GAsyncResult* res, gpointer d) {
+                auto* ref = static_cast<TabRef*>(d);
+                GdkTexture* tex = webkit_web_view_get_snapshot_finish(WEBKIT_WEB_VIEW(src), res, nullptr);
+                int i = ref->first->tab_pos(ref->second);
+                if (i >= 0) ref->first->finish_discard(*ref->first->tabs[i], WEBKIT_WEB_VIEW(src), tex);
+                if (tex) g_object_unref(tex);
+                delete ref;
+            }, new TabRef(this, t.id));
+    }
+
+    void finish_discard(TabData& t, WebKitWebView* src, GdkTexture* tex) {
+        t.discarding = false;
+        // Mientras se hacía la captura pudo volverse activa o cambiar de modo
+        if (t.webview != src || &t == &td()) return;
+
+        t.session = webkit_web_view_get_session_state(src);
+        GBytes* state = webkit_web_view_session_state_serialize(t.session);
+        t.discarded_bytes = g_bytes_get_size(state);
+        g_bytes_unref(state);
+        if (tex) t.snapshot = downscale_texture(tex, SNAPSHOT_MAX_W);
+        if (t.snapshot) {
+            t.discarded_bytes += (size_t)gdk_texture_get_width(t.snapshot) * gdk_texture_get_height(t.snapshot) * 4;
+            t.placeholder = gtk_picture_new_for_paintable(GDK_PAINTABLE(t.snapshot));
+            gtk_picture_set_content_fit(GTK_PICTURE(t.placeholder), GTK_CONTENT_FIT_COVER);
+        } else {
+            t.placeholder = gtk_label_new(t.title.empty() ? t.last_uri.c_str() : t.title.c_str());
+        }
+
+        tab_detach(src);
+        gtk_stack_remove(GTK_STACK(tab_stack), GTK_WIDGET(src));
+        t.webview = nullptr;
+        gtk_stack_add_named(GTK_STACK(tab_stack), t.placeholder, tab_name(t).c_str());
+        gtk_widget_add_css_class(t.tab_widget, "tab-discarded");
+    }
+
+    // Recrea el WebView y vuelve a la entrada actual del historial de sesión
+    void restore_tab(TabData& t) {
+        WebKitWebView* wview = make_webview(t.mode, false);
+        tab_attach(&t, wview);
+        setup_download_handler(wview);
+        gtk_stack_remove(GTK_STACK(tab_stack), t.placeholder);
+        t.placeholder = nullptr;
+        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(wview), tab_name(t).c_str());
+
+        WebKitBackForwardListItem* item = nullptr;
+        if (t.session) {
+            webkit_web_view_restore_session_state(wview, t.session);
+            webkit_web_view_session_state_unref(t.session);
+            t.session = nullptr;
+            item = webkit_back_forward_list_get_current_item(webkit_web_view_get_back_forward_list(wview));
+        }
+        if (item) webkit_web_view_go_to_back_forward_list_item(wview, item);
+        else      webkit_web_view_load_uri(wview, t.last_uri.empty() ? app->home_uri.c_str() : t.last_uri.c_str());
+
+        if (t.snapshot) g_object_unref(t.snapshot);
+        t.snapshot        = nullptr;
+        t.discarded_bytes = 0;
+        gtk_widget_remove_css_class(t.tab_widget, "tab-discarded");
+    }
+
+    // Política periódica: primero por inactividad, después por presupuesto,
+    // siempre empezando por la pestaña usada hace más tiempo.
+    void discard_idle_tabs() {
+        long idle_min  = cfg("discard_idle_min", 30L);
+        long budget_mb = cfg("discard_budget_mb", 0L);
+        if (idle_min <= 0 && budget_mb <= 0) return;
+
+        std::vector<TabData*> lru;
+        size_t resident = 0;
+        for (auto& t : tabs) {
+            if (t->webview) resident++;
+            if (can_discard(*t)) lru.push_back(t.get());
+        }
+        if (lru.empty()) return;
+        std::sort(lru.begin(), lru.end(), [](TabData* a, TabData* b){
+            return a->last_active_us < b->last_active_us;
+        });
+        double per_tab = budget_mb > 0 ? tab_cost_mb() : 0;
+        int64_t now = g_get_monotonic_time();
+        for (TabData* t : lru) {
+            bool idle = idle_min > 0 && now - t->last_active_us > idle_min * 60 * G_USEC_PER_SEC;
+            bool over = budget_mb > 0 && resident * per_tab > budget_mb;
+            if (!idle && !over) continue;
+            discard_tab(*t);
+            resident--;
+        }
+    }
+
+    // ── Sesión ───────────────────────────────────────────────────────────────
+    //
+    // Hasta que el almacén está listo (clave derivada) no se escribe nada;
+    // restore_session() recupera la sesión anterior, guarda un snapshot del
+    // estado actual y a partir de ahí cada cambio va al diario.
+    // config.json: "session_restore" (true) y "session_private_tabs": "skip"
+    // (por defecto, las pestañas Tor/I2P no vuelven) o "placeholder" (vuelven
+    // vacías en su modo).
+
+    static constexpr int SESSION_COMPACT_EVERY = 64;
+
+    json session_tab_json(const TabData& t) {
+        json j{{"id", t.id}, {"mode", t.mode}};
+        if (t.mode != "normal") return j;
+        j["uri"]     = t.last_uri;
+        j["title"]   = t.title;
+        j["origins"] = t.origins; // para no borrar sus cookies antes de volver a cargarla
+        WebKitWebViewSessionState* st = t.webview ? webkit_web_view_get_session_state(t.webview)
+                                      : t.session ? webkit_web_view_session_state_ref(t.session)
+                                                  : nullptr;
+        if (st) {
+            GBytes* bytes = webkit_web_view_session_state_serialize(st);
+            gsize n = 0;
+            const char* data = static_cast<const char*>(g_bytes_get_data(bytes, &n));
+            std::string b64;
+            base64_encode(std::string(data, n), b64);
+            j["state"] = std::move(b64);
+            g_bytes_unref(bytes);
+            webkit_web_view_session_state_unref(st);
+        }
+        return j;
+    }
+
+    void log_session(json rec) {
+        if (!session_live) return;
+        g_persist.append_journal(g_session_journal, std::move(rec));
+        if (++session_records >= SESSION_COMPACT_EVERY) compact_session();
+    }
+
+    void session_put(const TabData& t) {
+        json rec = session_tab_json(t);
+        rec["op"] = "put";
+        log_session(std::move(rec));
+    }
+
+    void compact_session() {
+        if (!session_live) return;
+        json s;
+        s["active"] = tabs.empty() ? 0u : td().id;
+        s["tabs"]   = json::array();
+        for (auto& t : tabs) s["tabs"].push_back(session_tab_json(*t));
+        g_persist.compact(g_session_file, std::move(s), g_session_journal);
+        session_records = 0;
+    }
+
+    // Las pestañas guardadas vuelven descartadas (sin WebView): solo la
+    // activa se carga, el resto se materializa en su primer switch_tab.
+    void restore_session() {
+        if (session_live) return;
+        json saved = std::move(app->session);
+        app->session = json::object();
+        session_live = true;
+        if (!saved.is_object()) saved = json::object();
+
+        // Si la única pestaña sigue en la página de inicio, la sesión la sustituye
+        bool pristine = tabs.size() == 1 && app->initial_url == app->home_uri &&
+                        (tabs[0]->last_uri.empty() || tabs[0]->last_uri == app->home_uri);
+        std::string private_policy = cfg("session_private_tabs", std::string("skip"));
+        uint32_t saved_active = saved.value("active", 0u);
+        int active = -1;
+        size_t restored = 0;
+        auto it = saved.find("tabs");
+        if (cfg("session_restore", true) && it != saved.end() && it->is_array()) {
+            for (auto& j : *it) {
+                if (!j.is_object()) continue;
+                std::string mode = j.value("mode", "normal");
+                if (mode != "normal" && private_policy != "placeholder") continue;
+
+                auto t = std::make_unique<TabData>();
+                t->id   = next_tab_id++;
+                t->mode = mode;
+                if (mode == "normal") {
+                    t->last_uri = j.value("uri", "");
+                    t->title    = j.value("title", "");
+                    auto origins = j.find("origins");
+                    if (origins != j.end() && origins->is_array())
+                        for (auto& o : *origins)
+                            if (o.is_string() && t->origins.size() < TAB_ORIGINS_MAX) t->origins.insert(o.get<std::string>());
+                    std::string state = j.value("state", "");
+                    if (!state.empty()) {
+                        base64_decode_inplace(state);
+                        GBytes* bytes = g_bytes_new(state.data(), state.size());
+                        t->session = webkit_web_view_session_state_new(bytes);
+                        g_bytes_unref(bytes);
+                    }
+                }
+                std::string label = !t->title.empty() ? t->title : !t->last_uri.empty() ? t->last_uri
+                                  : "Pestaña " + mode;
+                t->placeholder = gtk_label_new(label.c_str());
+                gtk_stack_add_named(GTK_STACK(tab_stack), t->placeholder, tab_name(*t).c_str());
+                make_tab_widget(*t);
+                if (label.size() > 14) label = label.substr(0,14) + "...";
+                gtk_button_set_label(t->title_btn, label.c_str());
+                gtk_widget_add_css_class(t->tab_widget, "tab-discarded");
+                if (j.value("id", 0u) == saved_active) active = (int)tabs.size();
+                tabs.push_back(std::move(t));
+                restored++;
+            }
+        }
+        if (restored && pristine) {
+            switch_tab(active >= 0 ? active : 1);
+            on_close_tab(0);
+        }
+        compact_session();
+    }
+
+    // ── Reserva de WebViews ──────────────────────────────────────────────────
+    //
+    // Por cada modo ya usado se mantienen "webview_pool" vistas (config.json,
+    // 1 por defecto, 0 = sin reserva) creadas, configuradas y con newtab.html
+    // cargado, que se reponen en idle. make_webview() entrega una de ellas a
+    // las pestañas nuevas en blanco (blank); las demás reciben una vista
+    // recién creada, porque newtab.html quedaría como entrada "atrás" de la
+    // dirección o la sesión que se cargue. Las señales de una vista en
+    // reserva no llegan a ninguna pestaña porque todavía no tiene TabData.
+
+    struct ViewPool {
+        std::vector<WebKitWebView*> views;   // referencia propia (no flotante)
+        bool   warm     = false;             // el modo se ha usado: reponer
+        size_t hits     = 0;
+        size_t misses   = 0;
+        size_t created  = 0;
+        double create_ms = 0;                // tiempo total en create_webview
+    };
+    std::map<std::string, ViewPool> view_pool;
+    guint pool_refill_id = 0;
+
+    static size_t pool_target() {
+        return (size_t)std::clamp(cfg("webview_pool", 1L), 0L, 8L);
+    }
+
+    // Devuelve la vista con una referencia flotante, como una recién creada,
+    // para que gtk_stack_add_named() la adopte igual en ambos casos.
+    WebKitWebView* make_webview(const std::string& mode, bool blank) {
+        ViewPool& pool = view_pool[mode];
+        pool.warm = true;
+        WebKitWebView* wview;
+        if (!blank) {
+            wview = timed_create_webview(mode, pool);
+        } else if (!pool.views.empty()) {
+            wview = pool.views.back();
+            pool.views.pop_back();
+            g_object_force_floating(G_OBJECT(wview));
+            pool.hits++;
+        } else {
+            wview = timed_create_webview(mode, pool);
+            pool.misses++;
+        }
+        schedule_pool_refill();
+        return wview;
+    }
+
+    WebKitWebView* timed_create_webview(const std::string& mode, ViewPool& pool) {
+        auto t0 = std::chrono::steady_clock::now();
+        WebKitWebView* wview = create_webview(mode);
+        pool.create_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        pool.created++;
+        return wview;
+    }
+
+    void schedule_pool_refill() {
+        if (pool_refill_id || pool_target() == 0) return;
+        pool_refill_id = g_idle_add_full(G_PRIORITY_LOW, [](gpointer d) -> gboolean {
+            return static_cast<BrowserWindow*>(d)->refill_pool_step();
+        }, this, nullptr);
+    }
+
+    // Una vista por iteración para no bloquear el bucle principal
+    gboolean refill_pool_step() {
+        size_t target = pool_target();
+        for (auto& [mode, pool] : view_pool) {
+            if (!pool.warm || pool.views.size() >= target) continue;
+            WebKitWebView* wview = timed_create_webview(mode, pool);
+            g_object_ref_sink(wview);
+            webkit_web_view_load_uri(wview, app->home_uri.c_str());
+            pool.views.push_back(wview);
+            return G_SOURCE_CONTINUE;
+        }
+        pool_refill_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    // ── Sesiones de red de los modos privados ────────────────────────────────
+    //
+    // Por defecto cada pestaña Tor/I2P tiene su propia sesión efímera. Con
+    // "shared_private_session": true en config.json todas las pestañas de un
+    // mismo modo comparten una sesión (conexiones y caché en caliente) y un
+    // WebKitWebContext propio cuyo modelo de caché sale de "private_cache_mb"
+    // (WebKit no permite fijar un tamaño exacto: 0 = sin caché, < 64 = caché
+    // de documentos, resto = caché de navegador). La sesión se vacía y se
+    // destruye al cerrarse la última pestaña de ese modo.
+
+    struct ModeSession {
+        WebKitNetworkSession* ns  = nullptr;
+        WebKitWebContext*     ctx = nullptr;
+    };
+    std::map<std::string, ModeSession> mode_sessions;
+
+    static WebKitNetworkSession* new_proxy_session(const std::string& mode) {
+        WebKitNetworkSession* ns = webkit_network_session_new_ephemeral();
+        WebKitNetworkProxySettings* ps = webkit_network_proxy_settings_new(
+            proxy_uri(*proxy_endpoint(mode)).c_str(), nullptr);
+        webkit_network_session_set_proxy_settings(ns, WEBKIT_NETWORK_PROXY_MODE_CUSTOM, ps);
+        webkit_network_proxy_settings_free(ps);
+        return ns;
+    }
+
+    ModeSession& shared_session(const std::string& mode) {
+        ModeSession& ms = mode_sessions[mode];
+        if (!ms.ns) {
+            ms.ns  = new_proxy_session(mode);
+            ms.ctx = webkit_web_context_new();
+            long cache_mb = cfg("private_cache_mb", 16L);
+            webkit_web_context_set_cache_model(ms.ctx,
+                cache_mb <= 0 ? WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER :
+                cache_mb < 64 ? WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER :
+                                WEBKIT_CACHE_MODEL_WEB_BROWSER);
+        }
+        return ms;
+    }
+
+    // Tras cerrar una pestaña o sacarla de un modo: si era la última de ese
+    // modo, borrar los datos de la sesión compartida y liberarla (junto con
+    // las vistas de reserva, que la mantendrían viva).
+    void release_mode_session(const std::string& mode) {
+        auto it = mode_sessions.find(mode);
+        if (it == mode_sessions.end()) return;
+        for (auto& t : tabs)
+            if (t->mode == mode || (t->retiring && t->retiring_mode == mode)) return;
+
+        ViewPool& pool = view_pool[mode];
+        for (WebKitWebView* v : pool.views) g_object_unref(v);
+        pool.views.clear();
+        pool.warm = false;
+
+        WebKitWebsiteDataManager* wdm = webkit_network_session_get_website_data_manager(it->second.ns);
+        if (wdm) webkit_website_data_manager_clear(wdm, WEBKIT_WEBSITE_DATA_ALL, 0, nullptr, nullptr, nullptr);
+        g_object_unref(it->second.ns);
+        g_object_unref(it->second.ctx);
+        mode_sessions.erase(it);
+    }
+
+    // ── Bloqueo de contenido ─────────────────────────────────────────────────
+    // La lista (blocker_list, por defecto easylist.txt) se convierte en un hilo
+    // aparte; si su SHA-256 coincide con el de la última compilación se carga
+    // el filtro ya compilado del store y si no se recompila y se guarda.
+
+    static constexpr const char* FILTER_ID = "prektbr-blocker";
+
+    WebKitUserContentFilterStore*   filter_store   = nullptr;
+    WebKitUserContentFilter*        content_filter = nullptr;
+    std::unordered_set<std::string> filter_hosts;
+    bool        blocker_on         = false;
+    bool        filter_loading     = false;
+    size_t      filter_rules       = 0;
+    size_t      filter_unsupported = 0;
+    double      filter_ms          = 0;   // conversión + compilación o carga
+    bool        filter_cached      = false;
+    std::string filter_status      = "desactivado";
+
+    struct FilterJob {
+        BrowserWindow*   win;
+        std::string      path, hash, error;
+        FilterConversion conv;
+        int64_t          start_us = 0;
+    };
+
+    void load_content_filter() {
+        blocker_on     = true;
+        filter_loading = true;
+        filter_status  = "leyendo la lista";
+        auto* job = new FilterJob{this, cfg("blocker_list", g_filter_list), "", "", {}, g_get_monotonic_time()};
+        std::thread([job](){
+            std::ifstream fin(job->path, std::ios::binary);
+            if (!fin) {
+                job->error = "no existe " + job->path;
+            } else {
+                std::string text((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+                unsigned char md[EVP_MAX_MD_SIZE];
+                unsigned int len = 0;
+                EVP_Digest(text.data(), text.size(), md, &len, EVP_sha256(), nullptr);
+                char hex[3];
+                for (unsigned int i = 0; i < len; i++) { snprintf(hex, sizeof(hex), "%02x", md[i]); job->hash += hex; }
+                std::istringstream in(text);
+                job->conv = convert_filter_list(in);
+            }
+            g_idle_add([](gpointer d) -> gboolean {
+                auto* j = static_cast<FilterJob*>(d);
+                j->win->on_filter_list(j);
+                return G_SOURCE_REMOVE;
+            }, job);
+        }).detach();
+    }
+
+    void on_filter_list(FilterJob* job) {
+        if (!job->error.empty()) {
+            filter_status  = job->error;
+            filter_loading = false;
+            delete job;
             return;
         }
-        clear_tab_data(tabs[idx]);
-        char name[32];
-        snprintf(name, sizeof(name), "tab%d", idx);
-        gtk_stack_remove(GTK_STACK(tab_stack), GTK_WIDGET(tabs[idx].webview));
-        tabs.erase(tabs.begin() + idx);
-        rebuild_tabbar();
-        int new_idx = std::min(idx, (int)tabs.size() - 1);
-        switch_tab(new_idx);
+        filter_hosts       = std::move(job->conv.hosts);
+        filter_rules       = job->conv.rules.size();
+        filter_unsupported = job->conv.unsupported;
+        if (!filter_store) {
+            fs::create_directories(g_filter_store_dir);
+            filter_store = webkit_user_content_filter_store_new(g_filter_store_dir.c_str());
+        }
+        std::string saved;
+        std::ifstream(g_filter_store_dir + "/" + FILTER_ID + ".sha256") >> saved;
+        if (saved != job->hash) { compile_content_filter(job); return; }
+
+        filter_status = "cargando";
+        webkit_user_content_filter_store_load(filter_store, FILTER_ID, nullptr,
+            [](GObject* src, GAsyncResult* res, gpointer d) {
+                auto* j = static_cast<FilterJob*>(d);
+                WebKitUserContentFilter* f = webkit_user_content_filter_store_load_finish(
+                    WEBKIT_USER_CONTENT_FILTER_STORE(src), res, nullptr);
+                if (!f) { j->win->compile_content_filter(j); return; }
+                j->win->filter_cached = true;
+                j->win->set_content_filter(f, j);
+            }, job);
     }
 
-    void clear_tab_data(TabData& t) {
-        WebKitNetworkSession* ns = webkit_web_view_get_network_session(t.webview);
-        if (!ns) return;
-        WebKitWebsiteDataManager* wdm = webkit_network_session_get_website_data_manager(ns);
-        if (!wdm) return;
-        webkit_website_data_manager_clear(wdm,
-            (WebKitWebsiteDataTypes)(
-                WEBKIT_WEBSITE_DATA_COOKIES |
-                WEBKIT_WEBSITE_DATA_DISK_CACHE |
-                WEBKIT_WEBSITE_DATA_MEMORY_CACHE |
-                WEBKIT_WEBSITE_DATA_SESSION_STORAGE |
-                WEBKIT_WEBSITE_DATA_LOCAL_STORAGE |
-                WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES |
-                WEBKIT_WEBSITE_DATA_OFFLINE_APPLICATION_CACHE
-            ),
-            0, nullptr, nullptr, nullptr
-        );
+    void compile_content_filter(FilterJob* job) {
+        filter_status = "compilando " + std::to_string(filter_rules) + " reglas";
+        std::string src = job->conv.rules.dump();
+        job->conv.rules = json();
+        GBytes* bytes = g_bytes_new(src.data(), src.size());
+        webkit_user_content_filter_store_save(filter_store, FILTER_ID, bytes, nullptr,
+            [](GObject* src, GAsyncResult* res, gpointer d) {
+                auto* j = static_cast<FilterJob*>(d);
+                GError* err = nullptr;
+                WebKitUserContentFilter* f = webkit_user_content_filter_store_save_finish(
+                    WEBKIT_USER_CONTENT_FILTER_STORE(src), res, &err);
+                if (!f) {
+                    j->win->filter_status  = std::string("error al compilar: ") + (err ? err->message : "?");
+                    j->win->filter_loading = false;
+                    if (err) g_error_free(err);
+                    delete j;
+                    return;
+                }
+                std::ofstream(g_filter_store_dir + "/" + FILTER_ID + ".sha256") << j->hash << "\n";
+                j->win->filter_cached = false;
+                j->win->set_content_filter(f, j);
+            }, job);
+        g_bytes_unref(bytes);
     }
 
-    void rebuild_tabbar() {
-        // Quitar todos los hijos del tabbar_box
-        GtkWidget* child = gtk_widget_get_first_child(tabbar_box);
-        while (child) {
-            GtkWidget* nxt = gtk_widget_get_next_sibling(child);
-            gtk_box_remove(GTK_BOX(tabbar_box), child);
-            child = nxt;
-        }
-        for (int i = 0; i < (int)tabs.size(); i++) {
-            make_tab_widget(i);
-            // Restaurar título
-            const char* title = webkit_web_view_get_title(tabs[i].webview);
-            if (title && *title && tabs[i].title_btn) {
-                std::string t = title;
-                if (t.size() > 14) t = t.substr(0,14) + "...";
-                gtk_button_set_label(tabs[i].title_btn, t.c_str());
-            }
+    void set_content_filter(WebKitUserContentFilter* f, FilterJob* job) {
+        filter_ms = (g_get_monotonic_time() - job->start_us) / 1000.0;
+        delete job;
+        if (content_filter) {
+            for_each_view([this](WebKitWebView* v){
+                webkit_user_content_manager_remove_filter(webkit_web_view_get_user_content_manager(v), content_filter);
+            });
+            webkit_user_content_filter_unref(content_filter);
         }
+        content_filter = f;
+        filter_status  = "listo";
+        filter_loading = false;
+        if (blocker_on) attach_content_filter(true);
     }
 
-    void switch_tab(int idx) {
-        if (idx < 0 || idx >= (int)tabs.size()) return;
+    void attach_content_filter(bool on) {
+        if (!content_filter) return;
+        for_each_view([this, on](WebKitWebView* v){
+            WebKitUserContentManager* ucm = webkit_web_view_get_user_content_manager(v);
+            if (on) webkit_user_content_manager_add_filter(ucm, content_filter);
+            else    webkit_user_content_manager_remove_filter(ucm, content_filter);
+        });
+    }
 
-        // Actualizar estilos
-        GtkWidget* child = gtk_widget_get_first_child(tabbar_box);
-        int i = 0;
-        while (child) {
-            gtk_widget_remove_css_class(child, "tab-active");
-            if (i == idx) gtk_widget_add_css_class(child, "tab-active");
-            child = gtk_widget_get_next_sibling(child);
-            i++;
+    // Todas las vistas vivas: pestañas, las que se retiran y la reserva
+    void for_each_view(const std::function<void(WebKitWebView*)>& fn) {
+        for (auto& t : tabs) {
+            if (t->webview)  fn(t->webview);
+            if (t->retiring) fn(t->retiring);
         }
+        for (auto& [mode, pool] : view_pool)
+            for (WebKitWebView* v : pool.views) fn(v);
+    }
 
-        current_tab = idx;
-        char name[32];
-        snprintf(name, sizeof(name), "tab%d", idx);
-        gtk_stack_set_visible_child_name(GTK_STACK(tab_stack), name);
+    // Lista de hosts (hosts.bin): se consulta en decide-policy
+    HostBlocklist hostlist;
+    std::string   hostlist_status = "sin lista";
+    size_t        hostlist_checks = 0;
+    size_t        hostlist_hits   = 0;
+    double        hostlist_ns     = 0;
+
+    void open_hostlist() {
+        std::string path = cfg("hostlist", g_hostlist_file), err;
+        if (hostlist.open(path, &err)) hostlist_status = path;
+        else if (fs::exists(path))     hostlist_status = path + ": " + err;
+    }
 
-        const char* uri = webkit_web_view_get_uri(tabs[idx].webview);
-        if (uri && strcmp(uri, "about:blank") != 0)
-            gtk_editable_set_text(GTK_EDITABLE(url_entry), uri);
-        else
-            gtk_editable_set_text(GTK_EDITABLE(url_entry), "");
+    bool host_blocked(const std::string& host) {
+        if (!blocker_on || !hostlist.loaded()) return false;
+        auto t0 = std::chrono::steady_clock::now();
+        bool hit = hostlist.blocked(str_tolower(host));
+        hostlist_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+        hostlist_checks++;
+        if (hit) hostlist_hits++;
+        return hit;
+    }
 
-        update_badge(tabs[idx].mode);
-        update_nav_buttons();
-        update_bookmark_star();
-        update_security_badge(uri ? uri : "");
+    void on_blocked_hosts(WebKitWebView* wview, const char* hosts) {
+        TabData* t = tab_of(wview);
+        if (!t || !blocker_on || !content_filter) return;
+        std::istringstream in(hosts);
+        std::string host;
+        while (in >> host)
+            if (filter_host_blocked(filter_hosts, str_tolower(host))) {
+                t->blocked_page++;
+                t->blocked_total++;
+            }
+    }
+
+    void print_blocker_stats() {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "Bloqueador: %s · %s", blocker_on ? "activo" : "inactivo", filter_status.c_str());
+        term_print(buf);
+        if (content_filter) {
+            snprintf(buf, sizeof(buf), "  %zu reglas (%zu no soportadas) · %s en %.0f ms",
+                     filter_rules, filter_unsupported, filter_cached ? "cargado del store" : "compilado", filter_ms);
+            term_print(buf);
+        }
+        term_print("  Lista: " + cfg("blocker_list", g_filter_list));
+        if (hostlist.loaded()) {
+            snprintf(buf, sizeof(buf), "  Hosts: %zu dominios (%zu KB en mmap) · %zu consultas · %zu bloqueadas · %.0f ns/consulta",
+                     hostlist.size(), hostlist.bytes() / 1024, hostlist_checks, hostlist_hits,
+                     hostlist_checks ? hostlist_ns / hostlist_checks : 0.0);
+            term_print(buf);
+        }
+        term_print("  Lista de hosts: " + hostlist_status);
+        size_t total = 0;
+        for (int i = 0; i < (int)tabs.size(); i++) {
+            const TabData& t = *tabs[i];
+            std::string title = t.title.empty() ? t.last_uri : t.title;
+            if (title.size() > 40) title = title.substr(0, 40) + "…";
+            snprintf(buf, sizeof(buf), "  %c %2d  página %4zu  total %5zu  ",
+                     i == current_tab ? '*' : ' ', i + 1, t.blocked_page, t.blocked_total);
+            term_print(buf + title);
+            total += t.blocked_total;
+        }
+        term_print("  Bloqueadas en total: " + std::to_string(total));
     }
 
     // ── Crear WebView ────────────────────────────────────────────────────────
 
-    WebKitWebView* make_webview(const std::string& mode) {
+    WebKitWebView* create_webview(const std::string& mode) {
         WebKitWebView* wview = nullptr;
 
-        if (mode == "tor") {
-            WebKitNetworkSession* ns = webkit_network_session_new_ephemeral();
-            WebKitNetworkProxySettings* ps = webkit_network_proxy_settings_new("socks5://127.0.0.1:9050", nullptr);
-            webkit_network_session_set_proxy_settings(ns, WEBKIT_NETWORK_PROXY_MODE_CUSTOM, ps);
-            webkit_network_proxy_settings_free(ps);
-            wview = WEBKIT_WEB_VIEW(g_object_new(WEBKIT_TYPE_WEB_VIEW, "network-session", ns, nullptr));
-            g_object_unref(ns);
-        } else if (mode == "i2p") {
-            WebKitNetworkSession* ns = webkit_network_session_new_ephemeral();
-            WebKitNetworkProxySettings* ps = webkit_network_proxy_settings_new("http://127.0.0.1:4444", nullptr);
-            webkit_network_session_set_proxy_settings(ns, WEBKIT_NETWORK_PROXY_MODE_CUSTOM, ps);
-            webkit_network_proxy_settings_free(ps);
+        if ((mode == "tor" || mode == "i2p") && cfg("shared_private_session", false)) {
+            ModeSession& ms = shared_session(mode);
+            wview = WEBKIT_WEB_VIEW(g_object_new(WEBKIT_TYPE_WEB_VIEW,
+                "network-session", ms.ns, "web-context", ms.ctx, nullptr));
+        } else if (mode == "tor" || mode == "i2p") {
+            WebKitNetworkSession* ns = new_proxy_session(mode);
             wview = WEBKIT_WEB_VIEW(g_object_new(WEBKIT_TYPE_WEB_VIEW, "network-session", ns, nullptr));
             g_object_unref(ns);
         } else {
@@ -1609,6 +6026,14 @@ struct BrowserWindow {
         g_signal_connect(wview, "notify::estimated-load-progress", G_CALLBACK(+[](WebKitWebView* wv, GParamSpec*, gpointer d){
             static_cast<BrowserWindow*>(d)->on_progress(wv);
         }), this);
+        g_signal_connect(wview, "mouse-target-changed", G_CALLBACK(+[](WebKitWebView* wv, WebKitHitTestResult* hit,
+                                                                      guint, gpointer d){
+            static_cast<BrowserWindow*>(d)->on_mouse_target(wv, hit);
+        }), this);
+        g_signal_connect(wview, "decide-policy", G_CALLBACK(+[](WebKitWebView* wv, WebKitPolicyDecision* dec,
+                                                               WebKitPolicyDecisionType type, gpointer d) -> gboolean {
+            return static_cast<BrowserWindow*>(d)->on_decide_policy(wv, dec, type);
+        }), this);
 
         // Inyectar script anti-fingerprinting
         WebKitUserContentManager* ucm = webkit_web_view_get_user_content_manager(wview);
@@ -1621,17 +6046,59 @@ struct BrowserWindow {
         webkit_user_content_manager_add_script(ucm, fp_script);
         webkit_user_script_unref(fp_script);
 
+        WebKitUserScript* origin_script = webkit_user_script_new_for_world(
+            ORIGIN_TRACK_JS,
+            WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+            WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+            PREKT_WORLD, nullptr, nullptr
+        );
+        webkit_user_content_manager_add_script(ucm, origin_script);
+        webkit_user_script_unref(origin_script);
+        webkit_user_content_manager_register_script_message_handler(ucm, "prektOrigins", PREKT_WORLD);
+        g_signal_connect(ucm, "script-message-received::prektOrigins", G_CALLBACK(+[](
+            WebKitUserContentManager*, JSCValue* msg, gpointer d) {
+            TabData* t = tab_of(WEBKIT_WEB_VIEW(d));
+            if (!t) return;
+            char* hosts = jsc_value_to_string(msg);
+            std::istringstream in(hosts ? hosts : "");
+            g_free(hosts);
+            std::string host;
+            while (in >> host && t->origins.size() < TAB_ORIGINS_MAX)
+                t->origins.insert(str_tolower(host));
+        }), wview);
+
+        WebKitUserScript* block_script = webkit_user_script_new_for_world(
+            BLOCK_COUNT_JS,
+            WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+            WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+            PREKT_WORLD, nullptr, nullptr
+        );
+        webkit_user_content_manager_add_script(ucm, block_script);
+        webkit_user_script_unref(block_script);
+        webkit_user_content_manager_register_script_message_handler(ucm, "prektBlocked", PREKT_WORLD);
+        g_object_set_data(G_OBJECT(ucm), "prektbr-view", wview);
+        g_signal_connect(ucm, "script-message-received::prektBlocked", G_CALLBACK(+[](
+            WebKitUserContentManager* m, JSCValue* msg, gpointer d) {
+            char* hosts = jsc_value_to_string(msg);
+            auto* v = static_cast<WebKitWebView*>(g_object_get_data(G_OBJECT(m), "prektbr-view"));
+            static_cast<BrowserWindow*>(d)->on_blocked_hosts(v, hosts ? hosts : "");
+            g_free(hosts);
+        }), this);
+        if (content_filter && blocker_on) webkit_user_content_manager_add_filter(ucm, content_filter);
+
         return wview;
     }
 
     // ── Señales del WebView ──────────────────────────────────────────────────
 
     void on_uri_changed(WebKitWebView* wview) {
-        if (tabs.empty()) return;
+        TabData* t = tab_of(wview);
+        if (!t) return;
         const char* uri = webkit_web_view_get_uri(wview);
         if (!uri || strcmp(uri, "about:blank") == 0) return;
-        if (wview == wv()) {
-            gtk_editable_set_text(GTK_EDITABLE(url_entry), uri);
+        t->last_uri = uri;
+        if (t == &td()) {
+            set_url_text(uri);
             update_bookmark_star();
             update_nav_buttons();
             update_security_badge(uri);
@@ -1641,34 +6108,53 @@ struct BrowserWindow {
     }
 
     void on_title_changed(WebKitWebView* wview) {
-        if (tabs.empty()) return;
+        TabData* t = tab_of(wview);
+        if (!t) return;
         const char* title = webkit_web_view_get_title(wview);
         if (!title) title = "";
+        t->title = title;
         // Actualizar pestaña
-        for (int i = 0; i < (int)tabs.size(); i++) {
-            if (tabs[i].webview == wview && tabs[i].title_btn) {
-                std::string t = title;
-                if (t.empty()) { char buf[16]; snprintf(buf,sizeof(buf),"Tab %d",i+1); t = buf; }
-                if (t.size() > 14) t = t.substr(0,14) + "...";
-                gtk_button_set_label(tabs[i].title_btn, t.c_str());
-                break;
-            }
+        if (t->title_btn) {
+            std::string label = *title ? title : "Nueva pestaña";
+            if (label.size() > 14) label = label.substr(0,14) + "...";
+            gtk_button_set_label(t->title_btn, label.c_str());
         }
-        if (wview == wv()) {
+        if (t == &td()) {
             std::string wtitle = *title ? std::string("PrekT-BR — ") + title : "PrekT-BR";
             gtk_window_set_title(GTK_WINDOW(window), wtitle.c_str());
         }
     }
 
     void on_load_changed(WebKitWebView* wview, WebKitLoadEvent event) {
+        TabData* t = tab_of(wview);
+        if (!t) return;
+        if (t->retiring && (event == WEBKIT_LOAD_COMMITTED || event == WEBKIT_LOAD_FINISHED))
+            finish_mode_switch(*t);
+        track_https_redirect(*t, wview, event);
+        if (event == WEBKIT_LOAD_COMMITTED) {
+            t->blocked_page = 0;
+            const char* uri = webkit_web_view_get_uri(wview);
+            std::string scheme, host;
+            if (uri) parse_uri(uri, scheme, host);
+            if (t->mode == "normal") note_prefetch_hit(str_tolower(host));
+            if (!host.empty() && t->origins.size() < TAB_ORIGINS_MAX) t->origins.insert(str_tolower(host));
+        }
+        t->provisional = event == WEBKIT_LOAD_STARTED || (t->provisional && event == WEBKIT_LOAD_REDIRECTED);
         if (event == WEBKIT_LOAD_STARTED) {
-            gtk_button_set_label(GTK_BUTTON(reload_btn), "✕");
-            gtk_widget_set_tooltip_text(reload_btn, "Detener carga");
+            t->loading       = true;
+            t->progress      = 0;
+            t->load_start_us = g_get_monotonic_time();
         } else if (event == WEBKIT_LOAD_FINISHED) {
-            gtk_button_set_label(GTK_BUTTON(reload_btn), "↻");
-            gtk_widget_set_tooltip_text(reload_btn, "Recargar (Ctrl+R)");
+            t->loading      = false;
+            t->last_load_ms = (g_get_monotonic_time() - t->load_start_us) / 1000.0;
+            session_put(*t);
+            apply_pending_scroll(*t);
+        }
+        if (t != &td()) return;
+        update_reload_button();
+        if (event == WEBKIT_LOAD_FINISHED) {
             gtk_label_set_text(GTK_LABEL(statusbar), "");
-            if (app->dark_mode && wview == wv()) {
+            if (app->dark_mode) {
                 g_timeout_add(400, [](gpointer d) -> gboolean {
                     static_cast<BrowserWindow*>(d)->apply_dark_css();
                     return G_SOURCE_REMOVE;
@@ -1678,23 +6164,399 @@ struct BrowserWindow {
     }
 
     void on_progress(WebKitWebView* wview) {
-        if (wview != wv()) return;
-        double p = webkit_web_view_get_estimated_load_progress(wview);
-        if (p > 0 && p < 1) {
+        TabData* t = tab_of(wview);
+        if (!t) return;
+        t->progress = webkit_web_view_get_estimated_load_progress(wview);
+        if (t != &td()) return;
+        if (t->progress > 0 && t->progress < 1) {
             char buf[64];
-            snprintf(buf, sizeof(buf), "Cargando… %d%%", (int)(p*100));
+            snprintf(buf, sizeof(buf), "Cargando… %d%%", (int)(t->progress*100));
             gtk_label_set_text(GTK_LABEL(statusbar), buf);
         } else {
             gtk_label_set_text(GTK_LABEL(statusbar), "");
         }
     }
 
+    // decide-policy también llega por las navegaciones de los iframes y no
+    // dice de qué marco vienen. Se atribuyen a la pestaña la carga pedida por
+    // la propia app (dirección, marcador, atrás/adelante: WebKit ya la expone
+    // como URI de la vista), un clic del usuario en un enlace y las
+    // redirecciones de la carga principal antes de confirmarse (hasta
+    // entonces el documento nuevo no tiene iframes).
+    static bool main_frame_navigation(WebKitWebView* wview, const TabData& t, WebKitPolicyDecisionType type,
+                                      WebKitNavigationAction* action, const char* uri) {
+        bool gesture = webkit_navigation_action_is_user_gesture(action);
+        if (type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) return gesture;
+        if (gesture && webkit_navigation_action_get_navigation_type(action) == WEBKIT_NAVIGATION_TYPE_LINK_CLICKED)
+            return true;
+        if (webkit_navigation_action_is_redirect(action)) return t.provisional;
+        const char* current = webkit_web_view_get_uri(wview);
+        return current && strcmp(current, uri) == 0;
+    }
+
+    // Las navegaciones a hosts con regla en routes no salen por la sesión de
+    // la pestaña: se cancelan y, si son de la página principal, se repiten en
+    // una vista del modo que toca.
+    gboolean on_decide_policy(WebKitWebView* wview, WebKitPolicyDecision* dec,
+                              WebKitPolicyDecisionType type) {
+        if (type != WEBKIT_POLICY_DECISION_TYPE_NAVIGATION_ACTION &&
+            type != WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) return FALSE;
+        TabData* t = tab_of(wview);
+        if (!t) return FALSE;
+        WebKitNavigationAction* action = webkit_navigation_policy_decision_get_navigation_action(
+            WEBKIT_NAVIGATION_POLICY_DECISION(dec));
+        const char* uri = webkit_uri_request_get_uri(webkit_navigation_action_get_request(action));
+        if (!uri) return FALSE;
+        std::string scheme, host;
+        parse_uri(uri, scheme, host);
+        if (scheme != "http" && scheme != "https") return FALSE;
+        if (host_blocked(host)) {
+            webkit_policy_decision_ignore(dec);
+            if (t == &td())
+                gtk_label_set_text(GTK_LABEL(statusbar), ("Bloqueado por la lista de hosts: " + host).c_str());
+            return TRUE;
+        }
+        const std::string* mode = routes.route(host);
+        if (!mode || *mode == t->mode) return upgrade_to_https(wview, *t, dec, type, action, host, uri);
+
+        webkit_policy_decision_ignore(dec);
+        // Un iframe o un script no mueven la pestaña a otra red; de Tor/I2P a
+        // la red normal, además, nunca por una redirección
+        if (!main_frame_navigation(wview, *t, type, action, uri) ||
+            (*mode == "normal" && webkit_navigation_action_is_redirect(action))) {
+            if (t == &td())
+                gtk_label_set_text(GTK_LABEL(statusbar), ("Bloqueado: " + host + " requiere modo " + *mode).c_str());
+            return TRUE;
+        }
+        if (type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) open_tab(uri, *mode);
+        else                                                       switch_network_mode(*t, *mode, uri);
+        return TRUE;
+    }
+
+    // ── Precarga de DNS ──────────────────────────────────────────────────────
+    // Al detenerse el ratón sobre un enlace o al dejar de escribir una
+    // dirección se resuelve su host por adelantado. Limitado por un cubo de
+    // fichas (PREFETCH_BURST, PREFETCH_RATE/s) y una espera por host. Solo en
+    // pestañas normales: en Tor/I2P el proxy resuelve los nombres y una
+    // consulta DNS local delataría el destino.
+
+    static constexpr guint   PREFETCH_HOVER_MS     = 150;
+    static constexpr guint   PREFETCH_TYPING_MS    = 400;
+    static constexpr int64_t PREFETCH_COOLDOWN_US  = 60 * G_USEC_PER_SEC;
+    static constexpr int64_t PREFETCH_HIT_WINDOW_US = 300 * G_USEC_PER_SEC;
+    static constexpr double  PREFETCH_BURST        = 8;
+    static constexpr double  PREFETCH_RATE         = 1;
+
+    struct Prefetched { int64_t at; bool used; };
+    std::unordered_map<std::string, Prefetched> prefetched;
+    double      prefetch_tokens    = PREFETCH_BURST;
+    int64_t     prefetch_refill_us = 0;
+    guint       prefetch_hover_id  = 0;
+    guint       prefetch_typing_id = 0;
+    std::string prefetch_hover_host;
+    struct {
+        size_t hover = 0, typed = 0, cooldown = 0, limited = 0, hits = 0;
+    } prefetch_stats;
+
+    void prefetch_host(const std::string& host_in, bool typed) {
+        if (!cfg("dns_prefetch", true) || tabs.empty()) return;
+        TabData& t = td();
+        if (t.mode != "normal" || !t.webview) return;
+        std::string host = str_tolower(host_in);
+        if (HttpsUpgrades::exempt(host)) return; // .onion/.i2p/.loki, IP, sin punto
+        const std::string* mode = routes.route(host);
+        if (mode && *mode != "normal") return;
+        if (blocker_on && hostlist.loaded() && hostlist.blocked(host)) return;
+
+        int64_t now = g_get_monotonic_time();
+        auto it = prefetched.find(host);
+        if (it != prefetched.end() && now - it->second.at < PREFETCH_COOLDOWN_US) {
+            prefetch_stats.cooldown++;
+            return;
+        }
+        if (prefetch_refill_us)
+            prefetch_tokens = std::min(PREFETCH_BURST,
+                prefetch_tokens + (now - prefetch_refill_us) / (double)G_USEC_PER_SEC * PREFETCH_RATE);
+        prefetch_refill_us = now;
+        if (prefetch_tokens < 1) {
+            prefetch_stats.limited++;
+            return;
+        }
+        prefetch_tokens -= 1;
+
+        if (prefetched.size() >= 1024)
+            for (auto i = prefetched.begin(); i != prefetched.end(); )
+                i = now - i->second.at > PREFETCH_HIT_WINDOW_US ? prefetched.erase(i) : std::next(i);
+        prefetched[host] = {now, false};
+        webkit_network_session_prefetch_dns(webkit_web_view_get_network_session(t.webview), host.c_str());
+        (typed ? prefetch_stats.typed : prefetch_stats.hover)++;
+    }
+
+    // Una carga confirmada de un host resuelto hace poco cuenta como acierto
+    void note_prefetch_hit(const std::string& host) {
+        auto it = prefetched.find(host);
+        if (it == prefetched.end() || it->second.used) return;
+        if (g_get_monotonic_time() - it->second.at > PREFETCH_HIT_WINDOW_US) return;
+        it->second.used = true;
+        prefetch_stats.hits++;
+    }
+
+    void on_mouse_target(WebKitWebView* wview, WebKitHitTestResult* hit) {
+        if (prefetch_hover_id) g_source_remove(prefetch_hover_id);
+        prefetch_hover_id = 0;
+        TabData* t = tab_of(wview);
+        if (!t || t != &td() || t->mode != "normal" || !webkit_hit_test_result_context_is_link(hit)) return;
+        const char* uri = webkit_hit_test_result_get_link_uri(hit);
+        std::string scheme;
+        if (!uri) return;
+        parse_uri(uri, scheme, prefetch_hover_host);
+        if (scheme != "http" && scheme != "https") return;
+        prefetch_hover_id = g_timeout_add(PREFETCH_HOVER_MS, [](gpointer d) -> gboolean {
+            auto* self = static_cast<BrowserWindow*>(d);
+            self->prefetch_hover_id = 0;
+            self->prefetch_host(self->prefetch_hover_host, false);
+            return G_SOURCE_REMOVE;
+        }, this);
+    }
+
+    void schedule_typed_prefetch() {
+        if (prefetch_typing_id) g_source_remove(prefetch_typing_id);
+        prefetch_typing_id = g_timeout_add(PREFETCH_TYPING_MS, [](gpointer d) -> gboolean {
+            auto* self = static_cast<BrowserWindow*>(d);
+            self->prefetch_typing_id = 0;
+            self->typed_prefetch();
+            return G_SOURCE_REMOVE;
+        }, this);
+    }
+
+    void typed_prefetch() {
+        const char* text_c = gtk_editable_get_text(GTK_EDITABLE(url_entry));
+        std::string text = str_trim(text_c ? text_c : "");
+        // Solo direcciones: ni búsquedas ni esquemas que resolve_input rechaza
+        size_t colon = text.find(':');
+        if (text.empty() || text.find(' ') != std::string::npos) return;
+        if (colon != std::string::npos && text.compare(0, 7, "http://") != 0 && text.compare(0, 8, "https://") != 0)
+            return;
+        std::string url = resolve_input(text), scheme, host;
+        parse_uri(url, scheme, host);
+        if ((scheme == "http" || scheme == "https") && host != "duckduckgo.com")
+            prefetch_host(host, true);
+    }
+
+    void print_prefetch_stats() {
+        size_t issued = prefetch_stats.hover + prefetch_stats.typed;
+        char buf[160];
+        term_print(std::string("Precarga de DNS: ") + (cfg("dns_prefetch", true) ? "activa" : "desactivada") +
+                   " (solo pestañas normales)");
+        snprintf(buf, sizeof(buf), "  Resueltos: %zu (%zu al pasar el ratón, %zu al escribir)",
+                 issued, prefetch_stats.hover, prefetch_stats.typed);
+        term_print(buf);
+        snprintf(buf, sizeof(buf), "  Acertados: %zu (%.0f%% de los resueltos se visitaron en 5 min)",
+                 prefetch_stats.hits, issued ? 100.0 * prefetch_stats.hits / issued : 0.0);
+        term_print(buf);
+        snprintf(buf, sizeof(buf), "  Omitidos: %zu por espera del host, %zu por límite de ritmo",
+                 prefetch_stats.cooldown, prefetch_stats.limited);
+        term_print(buf);
+    }
+
+    // ── Mejora a HTTPS ───────────────────────────────────────────────────────
+
+    size_t https_saved      = 0; // navegaciones reescritas: redirecciones ahorradas
+    size_t https_downgrades = 0; // sitios mejorados que redirigieron de vuelta a http
+
+    gboolean upgrade_to_https(WebKitWebView* wview, TabData& t, WebKitPolicyDecision* dec,
+                              WebKitPolicyDecisionType type, WebKitNavigationAction* action,
+                              const std::string& host_in, const char* uri) {
+        if (strncmp(uri, "http://", 7) != 0 || !cfg("https_upgrade", true)) return FALSE;
+        const char* method = webkit_uri_request_get_http_method(webkit_navigation_action_get_request(action));
+        if (method && strcmp(method, "GET") != 0) return FALSE;
+        // La reescritura vuelve a cargar la vista entera: un iframe http://
+        // se deja como está
+        if (!main_frame_navigation(wview, t, type, action, uri)) return FALSE;
+        std::string host = str_tolower(host_in);
+        // Un sitio mejorado que redirige de vuelta a http: se respeta y se olvida
+        if (webkit_navigation_action_is_redirect(action) && host == t.upgraded_host) {
+            app->forget_https(host);
+            https_downgrades++;
+            return FALSE;
+        }
+        if (!app->https_upgrades.should_upgrade(host)) return FALSE;
+
+        webkit_policy_decision_ignore(dec);
+        t.upgraded_host = host;
+        https_saved++;
+        std::string https = std::string("https://") + (uri + 7);
+        if (type == WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) open_tab(https, t.mode);
+        else                                                       webkit_web_view_load_uri(wview, https.c_str());
+        return TRUE;
+    }
+
+    // Una carga http:// que se confirma en https:// del mismo sitio fue una
+    // redirección: la próxima vez se reescribe directamente. Las pestañas
+    // Tor/I2P no aprenden nada (se guardaría en disco por dónde navegaron).
+    void track_https_redirect(TabData& t, WebKitWebView* wview, WebKitLoadEvent event) {
+        const char* uri = webkit_web_view_get_uri(wview);
+        std::string scheme, host;
+        if (uri) parse_uri(uri, scheme, host);
+        host = str_tolower(host);
+        if (event == WEBKIT_LOAD_STARTED) {
+            t.http_host = (scheme == "http" && t.mode == "normal") ? host : "";
+        } else if (event == WEBKIT_LOAD_COMMITTED) {
+            if (!t.http_host.empty() && scheme == "https" &&
+                (host == t.http_host || host == "www." + t.http_host || "www." + host == t.http_host))
+                app->learn_https(t.http_host);
+            t.http_host.clear();
+        } else if (event == WEBKIT_LOAD_FINISHED) {
+            t.upgraded_host.clear();
+        }
+    }
+
+    void update_reload_button() {
+        bool loading = !tabs.empty() && td().loading;
+        gtk_button_set_label(GTK_BUTTON(reload_btn), loading ? "✕" : "↻");
+        gtk_widget_set_tooltip_text(reload_btn, loading ? "Detener carga" : "Recargar (Ctrl+R)");
+    }
+
     // ── Navegación ───────────────────────────────────────────────────────────
 
     void on_back()    { if (webkit_web_view_can_go_back(wv()))    webkit_web_view_go_back(wv()); }
     void on_forward() { if (webkit_web_view_can_go_forward(wv())) webkit_web_view_go_forward(wv()); }
 
+    // ── Autocompletado ───────────────────────────────────────────────────────
+
+    void build_suggest_popover() {
+        suggest_list = gtk_list_box_new();
+        gtk_list_box_set_selection_mode(GTK_LIST_BOX(suggest_list), GTK_SELECTION_SINGLE);
+        gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(suggest_list), TRUE);
+        g_signal_connect(suggest_list, "row-activated", G_CALLBACK(+[](
+            GtkListBox*, GtkListBoxRow* row, gpointer d) {
+            auto* self = static_cast<BrowserWindow*>(d);
+            self->hide_suggestions();
+            self->open_suggestion(gtk_list_box_row_get_index(row));
+        }), this);
+
+        // Sin autohide el popover no roba el foco mientras se escribe
+        suggest_popover = gtk_popover_new();
+        gtk_widget_add_css_class(suggest_popover, "suggest-popover");
+        gtk_popover_set_autohide(GTK_POPOVER(suggest_popover), FALSE);
+        gtk_popover_set_has_arrow(GTK_POPOVER(suggest_popover), FALSE);
+        gtk_popover_set_position(GTK_POPOVER(suggest_popover), GTK_POS_BOTTOM);
+        gtk_popover_set_child(GTK_POPOVER(suggest_popover), suggest_list);
+        gtk_widget_set_parent(suggest_popover, url_entry);
+        g_signal_connect(url_entry, "destroy", G_CALLBACK(+[](GtkWidget*, gpointer d){
+            auto* self = static_cast<BrowserWindow*>(d);
+            if (self->suggest_popover) gtk_widget_unparent(self->suggest_popover);
+            self->suggest_popover = nullptr;
+        }), this);
+
+        g_signal_connect(url_entry, "changed", G_CALLBACK(+[](GtkEditable*, gpointer d){
+            auto* self = static_cast<BrowserWindow*>(d);
+            if (self->suggest_lock) return;
+            self->update_suggestions();
+            self->schedule_typed_prefetch();
+        }), this);
+
+        GtkEventController* keys = gtk_event_controller_key_new();
+        gtk_event_controller_set_propagation_phase(keys, GTK_PHASE_CAPTURE);
+        g_signal_connect(keys, "key-pressed", G_CALLBACK(+[](
+            GtkEventControllerKey*, guint kv, guint, GdkModifierType, gpointer d) -> gboolean {
+            auto* self = static_cast<BrowserWindow*>(d);
+            if (!self->suggest_popover || !gtk_widget_get_visible(self->suggest_popover)) return FALSE;
+            if (kv == GDK_KEY_Down)   { self->move_suggestion(1);  return TRUE; }
+            if (kv == GDK_KEY_Up)     { self->move_suggestion(-1); return TRUE; }
+            if (kv == GDK_KEY_Escape) { self->hide_suggestions();  return TRUE; }
+            return FALSE;
+        }), this);
+        gtk_widget_add_controller(url_entry, keys);
+
+        // Al perder el foco se cierra con un pequeño retraso para que un clic
+        // sobre una sugerencia llegue a activarla
+        GtkEventController* focus = gtk_event_controller_focus_new();
+        g_signal_connect(focus, "leave", G_CALLBACK(+[](GtkEventControllerFocus*, gpointer d){
+            g_timeout_add(150, [](gpointer d) -> gboolean {
+                static_cast<BrowserWindow*>(d)->hide_suggestions();
+                return G_SOURCE_REMOVE;
+            }, d);
+        }), this);
+        gtk_widget_add_controller(url_entry, focus);
+    }
+
+    // Cambios de texto que no vienen del teclado no abren sugerencias
+    void set_url_text(const char* text) {
+        suggest_lock = true;
+        gtk_editable_set_text(GTK_EDITABLE(url_entry), text);
+        suggest_lock = false;
+        hide_suggestions();
+    }
+
+    void hide_suggestions() {
+        if (suggest_popover && gtk_widget_get_visible(suggest_popover))
+            gtk_popover_popdown(GTK_POPOVER(suggest_popover));
+    }
+
+    // Solo memoria: nunca toca disco. Mientras el almacén se descifra no hay
+    // sugerencias.
+    void update_suggestions() {
+        if (!suggest_popover || !app->store_ready) return;
+        const char* text_c = gtk_editable_get_text(GTK_EDITABLE(url_entry));
+        std::string text = str_trim(text_c ? text_c : "");
+        auto hits = text.empty() ? std::vector<SearchIndex::Hit>()
+                                 : app->search_index.suggest(text, SUGGEST_MAX);
+        if (hits.empty()) {
+            hide_suggestions();
+            return;
+        }
+        gtk_list_box_remove_all(GTK_LIST_BOX(suggest_list));
+        suggest_urls.clear();
+        for (auto& h : hits) {
+            const auto& d = app->search_index.doc(h.doc);
+            GtkWidget* row = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+            gtk_widget_add_css_class(row, "suggest-row");
+            GtkWidget* title = gtk_label_new((d.bookmarked ? "★ " + d.title : d.title).c_str());
+            GtkWidget* url   = gtk_label_new(d.url.c_str());
+            for (GtkWidget* l : {title, url}) {
+                gtk_label_set_xalign(GTK_LABEL(l), 0.0f);
+                gtk_label_set_ellipsize(GTK_LABEL(l), PANGO_ELLIPSIZE_END);
+                gtk_label_set_max_width_chars(GTK_LABEL(l), 80);
+                gtk_box_append(GTK_BOX(row), l);
+            }
+            gtk_widget_add_css_class(title, "suggest-title");
+            gtk_widget_add_css_class(url, "suggest-url");
+            gtk_list_box_append(GTK_LIST_BOX(suggest_list), row);
+            suggest_urls.push_back(d.url);
+        }
+        gtk_widget_set_size_request(suggest_list, gtk_widget_get_width(url_entry), -1);
+        if (!gtk_widget_get_visible(suggest_popover))
+            gtk_popover_popup(GTK_POPOVER(suggest_popover));
+    }
+
+    void move_suggestion(int delta) {
+        GtkListBox* list = GTK_LIST_BOX(suggest_list);
+        GtkListBoxRow* cur = gtk_list_box_get_selected_row(list);
+        int n = (int)suggest_urls.size();
+        int idx = cur ? gtk_list_box_row_get_index(cur) + delta : (delta > 0 ? 0 : n - 1);
+        if (idx < 0 || idx >= n) {
+            gtk_list_box_select_row(list, nullptr);
+            return;
+        }
+        gtk_list_box_select_row(list, gtk_list_box_get_row_at_index(list, idx));
+    }
+
+    void open_suggestion(int idx) {
+        if (idx < 0 || idx >= (int)suggest_urls.size()) return;
+        std::string url = suggest_urls[idx];
+        set_url_text(url.c_str());
+        webkit_web_view_load_uri(wv(), url.c_str());
+    }
+
     void on_url_activate() {
+        GtkListBoxRow* row = suggest_popover && gtk_widget_get_visible(suggest_popover)
+            ? gtk_list_box_get_selected_row(GTK_LIST_BOX(suggest_list)) : nullptr;
+        hide_suggestions();
+        if (row) {
+            open_suggestion(gtk_list_box_row_get_index(row));
+            return;
+        }
         const char* text_c = gtk_editable_get_text(GTK_EDITABLE(url_entry));
         std::string text = str_trim(text_c ? text_c : "");
         if (text.empty()) return;
@@ -1746,15 +6608,23 @@ struct BrowserWindow {
             gtk_label_set_text(GTK_LABEL(statusbar), "Marcador eliminado");
         } else {
             const char* title = webkit_web_view_get_title(wv());
-            app->add_bookmark(uri, title ? title : uri);
+            switch (app->add_bookmark(uri, title ? title : uri)) {
+            case PrekTBR::BookmarkAdd::Added:
+                gtk_label_set_text(GTK_LABEL(statusbar), "Marcador guardado");
+                break;
+            case PrekTBR::BookmarkAdd::Pending:
+                gtk_label_set_text(GTK_LABEL(statusbar), "Marcador pendiente: se guardará al terminar de cargar los datos");
+                break;
+            case PrekTBR::BookmarkAdd::Rejected:
+                gtk_label_set_text(GTK_LABEL(statusbar), "No se pudo guardar el marcador");
+                break;
+            }
             gtk_button_set_label(GTK_BUTTON(bookmark_star), "★");
-            gtk_label_set_text(GTK_LABEL(statusbar), "Marcador guardado");
         }
         g_timeout_add(2000, [](gpointer d) -> gboolean {
             gtk_label_set_text(GTK_LABEL(static_cast<BrowserWindow*>(d)->statusbar), "");
             return G_SOURCE_REMOVE;
         }, this);
-        if (sidebar_mode == "bookmarks") show_sidebar("bookmarks");
     }
 
     void update_bookmark_star() {
@@ -1762,6 +6632,13 @@ struct BrowserWindow {
         gtk_button_set_label(GTK_BUTTON(bookmark_star), "★");
     }
 
+    // El almacén cifrado terminó de cargarse en segundo plano
+    void on_store_ready() {
+        restore_session();
+        update_bookmark_star();
+        if (!sidebar_mode.empty()) show_sidebar(sidebar_mode);
+    }
+
     // ── Sidebar ──────────────────────────────────────────────────────────────
 
     void toggle_sidebar(const std::string& mode) {
@@ -1774,10 +6651,16 @@ struct BrowserWindow {
             gtk_box_remove(GTK_BOX(content_area), sidebar_widget);
             sidebar_widget = nullptr;
         }
+        sidebar_view  = nullptr;
+        sidebar_empty = nullptr;
+        sidebar_feed  = nullptr;
+        if (sidebar_headers) g_object_unref(sidebar_headers);
+        sidebar_headers = nullptr;
         sidebar_mode = "";
     }
 
     void show_sidebar(const std::string& mode) {
+        if (mode != sidebar_mode) sidebar_query.clear();
         close_sidebar();
         sidebar_mode = mode;
 
@@ -1797,82 +6680,131 @@ struct BrowserWindow {
         gtk_box_append(GTK_BOX(title_box), lbl);
         gtk_box_append(GTK_BOX(title_box), close_btn);
 
-        GtkWidget* scroll = gtk_scrolled_window_new();
-        gtk_widget_set_vexpand(scroll, TRUE);
-        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
-                                       GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
-
-        GtkWidget* list_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 1);
-        gtk_widget_set_margin_top(list_box, 4);
-        gtk_widget_set_margin_bottom(list_box, 4);
-        gtk_widget_set_margin_start(list_box, 4);
-        gtk_widget_set_margin_end(list_box, 4);
+        // Búsqueda sobre el índice de trigramas
+        GtkWidget* search = gtk_search_entry_new();
+        gtk_widget_add_css_class(search, "sidebar-search");
+        gtk_editable_set_text(GTK_EDITABLE(search), sidebar_query.c_str());
+        g_signal_connect(search, "search-changed", G_CALLBACK(+[](GtkSearchEntry* e, gpointer d){
+            auto* self = static_cast<BrowserWindow*>(d);
+            self->sidebar_query = str_trim(gtk_editable_get_text(GTK_EDITABLE(e)));
+            self->refresh_sidebar();
+        }), this);
 
-        if (mode == "bookmarks") {
-            if (app->bookmarks.empty()) {
-                GtkWidget* empty = gtk_label_new("Sin marcadores aún");
-                gtk_widget_set_margin_top(empty, 20);
-                gtk_widget_add_css_class(empty, "sidebar-item");
-                gtk_box_append(GTK_BOX(list_box), empty);
-            }
-            for (auto& b : app->bookmarks) {
-                sidebar_item(list_box, b["title"].get<std::string>(),
-                             b["url"].get<std::string>(), true);
-            }
-        } else {
-            int start = std::max(0, (int)app->history.size() - 200);
-            std::vector<json> items(app->history.begin() + start, app->history.end());
-            std::reverse(items.begin(), items.end());
-            if (items.empty()) {
-                GtkWidget* empty = gtk_label_new("El historial está vacío");
-                gtk_widget_set_margin_top(empty, 20);
-                gtk_widget_add_css_class(empty, "sidebar-item");
-                gtk_box_append(GTK_BOX(list_box), empty);
-            }
-            for (auto& h : items) {
-                std::string ts = h.value("ts", "").substr(0, 10);
-                std::string label = "[" + ts + "] " + h.value("title", h.value("url",""));
-                sidebar_item(list_box, label, h["url"].get<std::string>(), false);
-            }
-        }
+        sidebar_empty = gtk_label_new("Descifrando datos…");
+        gtk_widget_set_margin_top(sidebar_empty, 20);
+        gtk_widget_add_css_class(sidebar_empty, "sidebar-item");
 
-        gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), list_box);
         gtk_box_append(GTK_BOX(outer), title_box);
-        gtk_box_append(GTK_BOX(outer), scroll);
+        gtk_box_append(GTK_BOX(outer), search);
+        gtk_box_append(GTK_BOX(outer), sidebar_empty);
+        if (app->store_ready) gtk_box_append(GTK_BOX(outer), build_sidebar_view());
         gtk_box_prepend(GTK_BOX(content_area), outer);
         sidebar_widget = outer;
+        refresh_sidebar();
     }
 
-    void sidebar_item(GtkWidget* box, const std::string& label,
-                      const std::string& url, bool removable) {
-        GtkWidget* row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 2);
-        GtkWidget* btn = gtk_button_new_with_label(label.c_str());
-        gtk_widget_add_css_class(btn, "sidebar-item");
-        gtk_widget_set_hexpand(btn, TRUE);
-
-        using StrPair = std::pair<BrowserWindow*,std::string>;
-        static auto load_cb    = +[](GtkButton*, gpointer d){ auto* p = static_cast<StrPair*>(d); webkit_web_view_load_uri(p->first->wv(), p->second.c_str()); };
-        static auto remove_cb  = +[](GtkButton*, gpointer d){ auto* p = static_cast<StrPair*>(d); p->first->app->remove_bookmark(p->second); p->first->show_sidebar("bookmarks"); };
-        static GClosureNotify str_destroy = [](gpointer p, GClosure*){ delete static_cast<StrPair*>(p); };
-
-        g_signal_connect_data(btn, "clicked",
-            G_CALLBACK(load_cb),
-            new StrPair(this, url),
-            str_destroy,
-            G_CONNECT_DEFAULT);
-
-        gtk_box_append(GTK_BOX(row), btn);
-        if (removable) {
+    // GtkListView sobre SidebarModel: las filas (etiqueta + "Quitar") se
+    // crean una vez en setup y se reutilizan en bind al desplazarse.
+    GtkWidget* build_sidebar_view() {
+        SidebarModel* model = sidebar_model_new(app);
+        sidebar_feed = model->feed;
+
+        GtkListItemFactory* factory = gtk_signal_list_item_factory_new();
+        g_signal_connect(factory, "setup", G_CALLBACK(+[](GtkSignalListItemFactory*, GObject* obj, gpointer d){
+            GtkWidget* row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 2);
+            GtkWidget* label = gtk_label_new("");
+            gtk_widget_add_css_class(label, "sidebar-item");
+            gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+            gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+            gtk_widget_set_hexpand(label, TRUE);
             GtkWidget* del_btn = gtk_button_new_with_label("Quitar");
             gtk_widget_add_css_class(del_btn, "close-tab-btn");
-            g_signal_connect_data(del_btn, "clicked",
-                G_CALLBACK(remove_cb),
-                new StrPair(this, url),
-                str_destroy,
-                G_CONNECT_DEFAULT);
+            g_object_set_data(G_OBJECT(del_btn), "list-item", obj);
+            g_signal_connect(del_btn, "clicked", G_CALLBACK(+[](GtkButton* b, gpointer d){
+                auto* item = GTK_LIST_ITEM(g_object_get_data(G_OBJECT(b), "list-item"));
+                if (gpointer row = gtk_list_item_get_item(item))
+                    static_cast<BrowserWindow*>(d)->app->remove_bookmark(sidebar_row_entry(row).url);
+            }), d);
+            gtk_box_append(GTK_BOX(row), label);
             gtk_box_append(GTK_BOX(row), del_btn);
-        }
-        gtk_box_append(GTK_BOX(box), row);
+            gtk_list_item_set_child(GTK_LIST_ITEM(obj), row);
+        }), this);
+        g_signal_connect(factory, "bind", G_CALLBACK(+[](GtkSignalListItemFactory*, GObject* obj, gpointer){
+            auto* item = GTK_LIST_ITEM(obj);
+            const SidebarEntry& e = sidebar_row_entry(gtk_list_item_get_item(item));
+            GtkWidget* row   = gtk_list_item_get_child(item);
+            GtkWidget* label = gtk_widget_get_first_child(row);
+            gtk_label_set_text(GTK_LABEL(label), e.label.c_str());
+            gtk_widget_set_tooltip_text(label, e.url.c_str());
+            gtk_widget_set_visible(gtk_widget_get_next_sibling(label), e.removable);
+        }), nullptr);
+
+        sidebar_view = gtk_list_view_new(GTK_SELECTION_MODEL(gtk_no_selection_new(G_LIST_MODEL(model))),
+                                         factory);
+        sidebar_headers = sidebar_header_factory();
+        gtk_list_view_set_single_click_activate(GTK_LIST_VIEW(sidebar_view), TRUE);
+        g_signal_connect(sidebar_view, "activate", G_CALLBACK(+[](GtkListView* v, guint pos, gpointer d){
+            auto* self = static_cast<BrowserWindow*>(d);
+            GListModel* items = G_LIST_MODEL(gtk_list_view_get_model(v));
+            if (gpointer row = g_list_model_get_item(items, pos)) {
+                webkit_web_view_load_uri(self->wv(), sidebar_row_entry(row).url.c_str());
+                g_object_unref(row);
+            }
+        }), this);
+
+        GtkWidget* scroll = gtk_scrolled_window_new();
+        gtk_widget_set_vexpand(scroll, TRUE);
+        gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll),
+                                       GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+        gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(scroll), sidebar_view);
+        return scroll;
+    }
+
+    // Encabezados de fecha del historial (solo sin búsqueda)
+    GtkListItemFactory* sidebar_header_factory() {
+        GtkListItemFactory* factory = gtk_signal_list_item_factory_new();
+        g_signal_connect(factory, "setup", G_CALLBACK(+[](GtkSignalListItemFactory*, GObject* obj, gpointer){
+            GtkWidget* label = gtk_label_new("");
+            gtk_widget_add_css_class(label, "sidebar-section");
+            gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+            gtk_list_header_set_child(GTK_LIST_HEADER(obj), label);
+        }), nullptr);
+        g_signal_connect(factory, "bind", G_CALLBACK(+[](GtkSignalListItemFactory*, GObject* obj, gpointer d){
+            auto* self = static_cast<BrowserWindow*>(d);
+            auto* header = GTK_LIST_HEADER(obj);
+            if (!self->sidebar_feed) return;
+            gtk_label_set_text(GTK_LABEL(gtk_list_header_get_child(header)),
+                               self->sidebar_feed->section_label(gtk_list_header_get_start(header)));
+        }), this);
+        return factory;
+    }
+
+    // Recarga la fuente tras cambiar de modo o de búsqueda
+    void refresh_sidebar() {
+        if (!sidebar_feed) return;
+        sidebar_feed->reset(sidebar_mode == "bookmarks", sidebar_query);
+        // Solo se cambia al entrar o salir de la búsqueda: reasignarla
+        // reconstruye todos los encabezados
+        GtkListItemFactory* headers = sidebar_feed->mode() == SidebarFeed::Mode::History
+                                    ? sidebar_headers : nullptr;
+        if (gtk_list_view_get_header_factory(GTK_LIST_VIEW(sidebar_view)) != headers)
+            gtk_list_view_set_header_factory(GTK_LIST_VIEW(sidebar_view), headers);
+        sync_sidebar_empty();
+    }
+
+    void sync_sidebar_empty() {
+        if (!sidebar_feed) return;
+        const char* text = sidebar_feed->mode() == SidebarFeed::Mode::Search    ? "Sin resultados"
+                         : sidebar_feed->mode() == SidebarFeed::Mode::Bookmarks ? "Sin marcadores aún"
+                                                                                : "El historial está vacío";
+        gtk_label_set_text(GTK_LABEL(sidebar_empty), text);
+        gtk_widget_set_visible(sidebar_empty, sidebar_feed->size() == 0);
+    }
+
+    void on_store_change(const PrekTBR::StoreChange& c) {
+        if (!sidebar_feed) return;
+        sidebar_feed->apply(c);
+        sync_sidebar_empty();
     }
 
     // ── Badge de modo de red ─────────────────────────────────────────────────
@@ -1882,12 +6814,13 @@ struct BrowserWindow {
         gtk_widget_remove_css_class(badge, "badge-tor");
         gtk_widget_remove_css_class(badge, "badge-i2p");
         gtk_widget_remove_css_class(badge, "badge-clear");
+        gtk_widget_set_tooltip_text(badge, "Modo de red actual");
         if (mode == "tor") {
-            gtk_label_set_text(GTK_LABEL(badge), "TOR");
+            gtk_label_set_text(GTK_LABEL(badge), ("TOR" + probe_badge_text(mode)).c_str());
             gtk_widget_add_css_class(badge, "badge-tor");
             gtk_widget_set_visible(badge, TRUE);
         } else if (mode == "i2p") {
-            gtk_label_set_text(GTK_LABEL(badge), "I2P");
+            gtk_label_set_text(GTK_LABEL(badge), ("I2P" + probe_badge_text(mode)).c_str());
             gtk_widget_add_css_class(badge, "badge-i2p");
             gtk_widget_set_visible(badge, TRUE);
         } else {
@@ -1897,6 +6830,21 @@ struct BrowserWindow {
         }
     }
 
+    // Latencia del último sondeo (" 85 ms" o " ✕"); de paso ajusta el tooltip
+    std::string probe_badge_text(const std::string& mode) {
+        auto it = probe_log.find(mode);
+        if (it == probe_log.end() || it->second.empty()) return "";
+        const ProbeResult& r = it->second.back();
+        std::string addr = proxy_uri(*proxy_endpoint(mode));
+        if (!r.ok) {
+            gtk_widget_set_tooltip_text(badge, ("El proxy " + addr + " no responde: " + r.error).c_str());
+            return " ✕";
+        }
+        std::string ms = std::to_string((long)std::lround(r.ms)) + " ms";
+        gtk_widget_set_tooltip_text(badge, ("Proxy " + addr + " — " + ms).c_str());
+        return " " + ms;
+    }
+
     // ── Modo oscuro ──────────────────────────────────────────────────────────
 
     void apply_dark_css() {
@@ -2325,6 +7273,82 @@ struct BrowserWindow {
 
     // ── Modos de red ─────────────────────────────────────────────────────────
 
+    // ── Estado de los proxies ────────────────────────────────────────────────
+    // Sondeos al cambiar de modo y periódicos (proxy_probe_s) de los modos con
+    // pestañas abiertas; cada modo guarda sus últimos PROBE_LOG_MAX resultados.
+
+    static constexpr size_t PROBE_LOG_MAX    = 20;
+    static constexpr int    PROBE_TIMEOUT_MS = 3000;
+    std::map<std::string, std::deque<ProbeResult>> probe_log;
+    std::set<std::string>                          probing;
+
+    void probe_mode(const std::string& mode) {
+        const ProxyEndpoint* ep = proxy_endpoint(mode);
+        if (!ep || !probing.insert(mode).second) return;
+        struct Probed { BrowserWindow* win; const ProxyEndpoint* ep; ProbeResult r; };
+        BrowserWindow* self = this;
+        std::thread([self, ep](){
+            auto* p = new Probed{self, ep, probe_proxy(*ep, PROBE_TIMEOUT_MS)};
+            g_idle_add([](gpointer d) -> gboolean {
+                auto* pp = static_cast<Probed*>(d);
+                pp->win->on_probe_result(pp->ep->mode, pp->r);
+                delete pp;
+                return G_SOURCE_REMOVE;
+            }, p);
+        }).detach();
+    }
+
+    void probe_active_modes() {
+        std::set<std::string> modes;
+        for (auto& t : tabs) modes.insert(t->mode);
+        for (auto& m : modes) probe_mode(m);
+    }
+
+    void on_probe_result(const std::string& mode, const ProbeResult& r) {
+        probing.erase(mode);
+        auto& log = probe_log[mode];
+        bool was_ok = log.empty() || log.back().ok;
+        log.push_back(r);
+        if (log.size() > PROBE_LOG_MAX) log.pop_front();
+        if (tabs.empty() || td().mode != mode) return;
+        update_badge(mode);
+        // Solo se avisa al caer, no en cada sondeo fallido
+        if (!r.ok && was_ok) {
+            std::string msg = "El proxy " + proxy_uri(*proxy_endpoint(mode)) + " no responde: " + r.error;
+            gtk_label_set_text(GTK_LABEL(statusbar), msg.c_str());
+        }
+    }
+
+    void print_netstatus() {
+        for (auto& ep : PROXY_ENDPOINTS) {
+            term_print(std::string(ep.mode) + " — " + proxy_uri(ep));
+            auto it = probe_log.find(ep.mode);
+            if (it == probe_log.end() || it->second.empty()) {
+                term_print("  sin sondeos todavía");
+            } else {
+                size_t ok = 0;
+                double sum = 0, lo = 0, hi = 0;
+                for (auto& r : it->second) {
+                    char buf[32];
+                    snprintf(buf, sizeof(buf), "%.1f ms", r.ms);
+                    term_print("  " + format_ts(r.at, "%H:%M:%S") + "  " + (r.ok ? buf : "✕ " + r.error));
+                    if (!r.ok) continue;
+                    lo = ok ? std::min(lo, r.ms) : r.ms;
+                    hi = std::max(hi, r.ms);
+                    sum += r.ms;
+                    ok++;
+                }
+                char buf[128];
+                if (ok) snprintf(buf, sizeof(buf), "  %zu/%zu correctos · mín %.1f · media %.1f · máx %.1f ms",
+                                 ok, it->second.size(), lo, sum / ok, hi);
+                else    snprintf(buf, sizeof(buf), "  0/%zu correctos", it->second.size());
+                term_print(buf);
+            }
+            probe_mode(ep.mode);
+        }
+        term_print("Sondeo nuevo en curso; el indicador de modo se actualizará al terminar.");
+    }
+
     void enable_network_mode(const std::string& mode) {
         TabData& t = td();
         if (t.mode == mode) {
@@ -2332,22 +7356,7 @@ struct BrowserWindow {
             term_prompt();
             return;
         }
-        const char* old_uri_c = webkit_web_view_get_uri(t.webview);
-        std::string old_uri = old_uri_c ? old_uri_c : app->home_uri;
-
-        WebKitWebView* new_wv = make_webview(mode);
-        int idx = current_tab;
-        char name[32];
-        snprintf(name, sizeof(name), "tab%d", idx);
-
-        gtk_stack_remove(GTK_STACK(tab_stack), GTK_WIDGET(t.webview));
-        t.webview = new_wv;
-        t.mode    = mode;
-        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(new_wv), name);
-        gtk_stack_set_visible_child_name(GTK_STACK(tab_stack), name);
-        webkit_web_view_load_uri(new_wv,
-            (old_uri == "about:blank") ? app->home_uri.c_str() : old_uri.c_str());
-        update_badge(mode);
+        switch_network_mode(t, mode);
 
         if (mode == "tor") {
             term_print("  MODO TOR ACTIVADO — WebRTC deshabilitado");
@@ -2366,26 +7375,114 @@ struct BrowserWindow {
             term_prompt();
             return;
         }
-        const char* old_uri_c = webkit_web_view_get_uri(t.webview);
-        std::string old_uri = old_uri_c ? old_uri_c : app->home_uri;
-
-        WebKitWebView* new_wv = make_webview("normal");
-        int idx = current_tab;
-        char name[32];
-        snprintf(name, sizeof(name), "tab%d", idx);
-
-        gtk_stack_remove(GTK_STACK(tab_stack), GTK_WIDGET(t.webview));
-        t.webview = new_wv;
-        t.mode    = "normal";
-        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(new_wv), name);
-        gtk_stack_set_visible_child_name(GTK_STACK(tab_stack), name);
-        webkit_web_view_load_uri(new_wv,
-            (old_uri == "about:blank") ? app->home_uri.c_str() : old_uri.c_str());
-        update_badge("normal");
+        switch_network_mode(t, "normal");
         term_print("  Modo normal restaurado.");
         term_prompt();
     }
 
+    // El WebView nuevo hereda el historial atrás/adelante, el zoom y el
+    // desplazamiento del anterior. Entra en tab_stack con un nombre provisional
+    // y el anterior sigue visible hasta que el nuevo confirma su primera carga.
+    // Con next_uri (enrutado por host) se carga esa dirección en lugar de la
+    // entrada actual, que queda como página anterior.
+    void switch_network_mode(TabData& t, const std::string& mode, const std::string& next_uri = "") {
+        if (t.retiring) finish_mode_switch(t);
+        WebKitWebView* old_wv = t.webview;
+        // El historial atrás/adelante de una pestaña Tor/I2P no pasa a la
+        // vista nueva: "atrás" cargaría esas páginas por otra red y
+        // session_put acabaría guardándolas en session.json.
+        WebKitWebViewSessionState* state = t.mode == "normal"
+            ? webkit_web_view_get_session_state(old_wv) : nullptr;
+        double zoom = webkit_web_view_get_zoom_level(old_wv);
+        const char* old_uri_c = webkit_web_view_get_uri(old_wv);
+        std::string old_uri = (old_uri_c && strcmp(old_uri_c, "about:blank") != 0)
+            ? old_uri_c : app->home_uri;
+        if (next_uri.empty()) capture_scroll(t, old_wv);
+        else                  t.scroll_pending = false;
+
+        WebKitWebView* new_wv = make_webview(mode, false);
+        setup_download_handler(new_wv);
+        tab_detach(old_wv);
+        tab_attach(&t, new_wv);
+        t.retiring      = old_wv;
+        t.retiring_mode = t.mode;
+        t.mode          = mode;
+        t.loading       = true;
+        gtk_stack_add_named(GTK_STACK(tab_stack), GTK_WIDGET(new_wv), (tab_name(t) + "-next").c_str());
+
+        WebKitBackForwardListItem* item = nullptr;
+        if (state) {
+            webkit_web_view_restore_session_state(new_wv, state);
+            webkit_web_view_session_state_unref(state);
+            item = webkit_back_forward_list_get_current_item(webkit_web_view_get_back_forward_list(new_wv));
+        }
+        if (!next_uri.empty()) webkit_web_view_load_uri(new_wv, next_uri.c_str());
+        else if (item)         webkit_web_view_go_to_back_forward_list_item(new_wv, item);
+        else                   webkit_web_view_load_uri(new_wv, old_uri.c_str());
+        webkit_web_view_set_zoom_level(new_wv, zoom);
+
+        session_put(t);
+        probe_mode(mode);
+        if (&t == &td()) update_badge(mode);
+    }
+
+    // Se pide la posición al WebView anterior; si la respuesta llega cuando
+    // el nuevo ya terminó de cargar, se aplica en ese momento.
+    void capture_scroll(TabData& t, WebKitWebView* old_wv) {
+        t.scroll_pending = false;
+        using TabRef = std::pair<BrowserWindow*,uint32_t>;
+        webkit_web_view_evaluate_javascript(old_wv,
+            "window.scrollX + ',' + window.scrollY", -1, nullptr, nullptr, nullptr,
+            [](GObject* src, GAsyncResult* res, gpointer d) {
+                auto* ref = static_cast<TabRef*>(d);
+                JSCValue* val = webkit_web_view_evaluate_javascript_finish(WEBKIT_WEB_VIEW(src), res, nullptr);
+                int i = ref->first->tab_pos(ref->second);
+                if (val && i >= 0) {
+                    TabData& t = *ref->first->tabs[i];
+                    char* xy = jsc_value_to_string(val);
+                    if (xy && sscanf(xy, "%lf,%lf", &t.scroll_x, &t.scroll_y) == 2
+                        && (t.scroll_x > 0 || t.scroll_y > 0)) {
+                        t.scroll_pending = true;
+                        if (!t.loading) ref->first->apply_pending_scroll(t);
+                    }
+                    g_free(xy);
+                }
+                if (val) g_object_unref(val);
+                delete ref;
+            }, new TabRef(this, t.id));
+    }
+
+    void apply_pending_scroll(TabData& t) {
+        if (!t.scroll_pending || !t.webview) return;
+        t.scroll_pending = false;
+        char js[96];
+        snprintf(js, sizeof(js), "window.scrollTo(%.0f, %.0f);", t.scroll_x, t.scroll_y);
+        webkit_web_view_evaluate_javascript(t.webview, js, -1, nullptr, nullptr, nullptr, nullptr, nullptr);
+    }
+
+    // El WebView nuevo toma el nombre de la pestaña; el anterior se destruye
+    // en una iteración posterior del bucle para no bloquear el cambio.
+    void finish_mode_switch(TabData& t) {
+        WebKitWebView* old_wv = t.retiring;
+        std::string name = tab_name(t);
+        GtkStack* stack = GTK_STACK(tab_stack);
+        t.retiring = nullptr;
+        gtk_stack_page_set_name(gtk_stack_get_page(stack, GTK_WIDGET(old_wv)), (name + "-old").c_str());
+        gtk_stack_page_set_name(gtk_stack_get_page(stack, GTK_WIDGET(t.webview)), name.c_str());
+        if (&t == &td()) gtk_stack_set_visible_child(stack, GTK_WIDGET(t.webview));
+        webkit_web_view_stop_loading(old_wv);
+
+        struct Retired { BrowserWindow* win; WebKitWebView* view; std::string mode; };
+        g_idle_add([](gpointer d) -> gboolean {
+            auto* r = static_cast<Retired*>(d);
+            gtk_stack_remove(GTK_STACK(r->win->tab_stack), GTK_WIDGET(r->view));
+            r->win->release_mode_session(r->mode);
+            delete r;
+            return G_SOURCE_REMOVE;
+        }, new Retired{this, old_wv, t.retiring_mode});
+        t.retiring_mode.clear();
+    }
+
     // ── Terminal: entrada/salida ─────────────────────────────────────────────
 
     void term_print(const std::string& text, bool no_nl = false) {
@@ -2466,6 +7563,10 @@ struct BrowserWindow {
                 "  newtab [url]          → abre nueva pestaña\n"
                 "  closetab              → cierra pestaña actual\n"
                 "  tab <n>               → cambia a pestaña n (1-based)\n"
+                "  tabs                  → lista pestañas, residentes y coste estimado\n"
+                "  discard [n]           → descarta la pestaña n (o todas las de fondo)\n"
+                "  benchtabs [n]         → abre y cierra n pestañas (def. 500) y mide\n"
+                "  viewpool              → estado de la reserva de WebViews por modo\n"
                 "  back / forward        → historial del navegador\n"
                 "  reload                → recarga normal\n"
                 "  reloadhard            → recarga sin caché\n"
@@ -2481,12 +7582,21 @@ struct BrowserWindow {
                 "  i2pmode               → activa I2P en esta pestaña\n"
                 "  clearnet              → vuelve a modo normal\n"
                 "  loki <direccion>      → abre direccion.loki (requiere lokinet.service)\n"
+                "  route [host]          → reglas de enrutado por host / modo de un host\n"
+                "  netstatus             → latencia e historial de los proxies Tor/I2P\n"
+                "  blocker [on|off|stats] → bloqueador de anuncios/rastreadores (EasyList)\n"
+                "  https [forget <host>] → mejora a HTTPS: ahorros / olvidar un host\n"
+                "  prefetch              → aciertos de la precarga de DNS\n"
                 "  whoami                → tu IP pública\n"
                 "  serverip              → IP del servidor actual\n"
                 "─── Marcadores e historial ───────────────────\n"
                 "  bookmark              → guarda/quita marcador actual\n"
-                "  bookmarks             → lista marcadores\n"
+                "  bookmarks [filtro]    → lista marcadores (carpeta o #etiqueta)\n"
+                "  bmfolder <carpeta>    → mueve el marcador actual a una carpeta\n"
+                "  bmtag <etiquetas>     → etiquetas del marcador actual\n"
+                "  importbookmarks <f>   → importa un HTML de marcadores (Netscape)\n"
                 "  history [n]           → últimas n URLs (def. 10)\n"
+                "  search <términos>     → busca en historial y marcadores\n"
                 "─── Utilidades ───────────────────────────────\n"
                 "  dark                  → toggle modo oscuro\n"
                 "  calc <expr>           → calculadora\n"
@@ -2517,6 +7627,49 @@ struct BrowserWindow {
             open_tab(args.empty() ? "" : resolve_input(args));
         } else if (cmd == "closetab") {
             on_close_tab(current_tab);
+        } else if (cmd == "tabs") {
+            double per_tab = tab_cost_mb();
+            int64_t now = g_get_monotonic_time();
+            for (int i = 0; i < (int)tabs.size(); i++) {
+                const TabData& t = *tabs[i];
+                char buf[256];
+                std::string name = t.title.empty() ? (t.last_uri.empty() ? "(nueva)" : t.last_uri) : t.title;
+                if (name.size() > 32) name = name.substr(0, 32) + "...";
+                double cost = t.webview ? per_tab : t.discarded_bytes / 1048576.0;
+                long idle = i == current_tab ? 0 : (long)((now - t.last_active_us) / (60 * G_USEC_PER_SEC));
+                snprintf(buf, sizeof(buf), "  %2d %s %-36s %-6s ~%6.1f MB  inactiva %ld min",
+                         i + 1, i == current_tab ? "*" : t.webview ? " " : "z",
+                         name.c_str(), t.mode.c_str(), cost, idle);
+                term_print(buf);
+            }
+            term_print("  (* activa, z descartada; coste estimado a partir del RSS de los renderers)");
+        } else if (cmd == "discard") {
+            int n = 0;
+            if (args.empty()) {
+                for (auto& t : tabs) if (can_discard(*t)) { discard_tab(*t); n++; }
+            } else {
+                int i = -1;
+                try { i = std::stoi(args) - 1; } catch (...) {}
+                if (i < 0 || i >= (int)tabs.size())   term_print("Uso: discard [n]");
+                else if (!can_discard(*tabs[i]))      term_print("  Esa pestaña no se puede descartar (activa, ya descartada, con audio o Tor/I2P con sesión propia).");
+                else { discard_tab(*tabs[i]); n = 1; }
+            }
+            term_print("  " + std::to_string(n) + " pestaña(s) descartada(s).");
+        } else if (cmd == "viewpool") {
+            char buf[200];
+            snprintf(buf, sizeof(buf), "  Reserva de WebViews: %zu por modo (webview_pool)", pool_target());
+            term_print(buf);
+            for (auto& [mode, pool] : view_pool) {
+                snprintf(buf, sizeof(buf), "  %-7s listas %zu  entregadas %zu  creadas al momento %zu  creación media %.1f ms%s",
+                         mode.c_str(), pool.views.size(), pool.hits, pool.misses,
+                         pool.created ? pool.create_ms / pool.created : 0.0,
+                         pool.warm ? "" : "  (sin usar)");
+                term_print(buf);
+            }
+        } else if (cmd == "benchtabs") {
+            int n = 500;
+            try { if (!args.empty()) n = std::clamp(std::stoi(args), 1, 5000); } catch (...) {}
+            bench_tabs(n);
         } else if (cmd == "tab") {
             try {
                 int n = std::stoi(args) - 1;
@@ -2580,6 +7733,50 @@ struct BrowserWindow {
             } else {
                 term_print("Uso: loki <direccion>  (ejemplo: loki stats.i2p.rocks)");
             }
+        } else if (cmd == "route") {
+            std::string host = str_trim(args);
+            if (host.empty()) {
+                for (auto& [rule, mode] : routes.rules())
+                    term_print("  " + rule + std::string(rule.size() < 24 ? 24 - rule.size() : 1, ' ') + "→ " + mode);
+            } else {
+                std::string scheme;
+                if (host.find("://") != std::string::npos) parse_uri(host, scheme, host);
+                const std::string* mode = routes.route(host);
+                term_print("  " + host + " → " + (mode ? *mode : "modo de la pestaña"));
+            }
+        } else if (cmd == "blocker") {
+            std::string sub = str_trim(args);
+            if (sub == "on") {
+                if (!content_filter && !filter_loading) load_content_filter();
+                else if (!blocker_on) { blocker_on = true; attach_content_filter(true); }
+                term_print("Bloqueador activado (recarga la página para aplicarlo).");
+            } else if (sub == "off") {
+                if (blocker_on) attach_content_filter(false);
+                blocker_on = false;
+                term_print("Bloqueador desactivado (recarga la página para aplicarlo).");
+            } else if (sub.empty() || sub == "stats") {
+                print_blocker_stats();
+            } else {
+                term_print("Uso: blocker [on|off|stats]");
+            }
+        } else if (cmd == "prefetch") {
+            print_prefetch_stats();
+        } else if (cmd == "https") {
+            std::string sub = str_trim(args);
+            if (sub.compare(0, 7, "forget ") == 0) {
+                std::string host = str_tolower(str_trim(sub.substr(7)));
+                app->forget_https(host);
+                term_print("  " + host + " ya no se reescribe a HTTPS (salvo si está en la tabla precargada).");
+            } else {
+                term_print("Mejora a HTTPS:");
+                term_print("  Idas y vueltas ahorradas: " + std::to_string(https_saved) + " (esta sesión)");
+                term_print("  Hosts aprendidos: " + std::to_string(app->https_upgrades.learned()) +
+                           " · precargados: " + std::to_string(app->https_upgrades.preloaded()));
+                if (https_downgrades)
+                    term_print("  Sitios que volvieron a http: " + std::to_string(https_downgrades));
+            }
+        } else if (cmd == "netstatus") {
+            print_netstatus();
         } else if (cmd == "tormode") {
             enable_network_mode("tor"); return;
         } else if (cmd == "i2pmode") {
@@ -2656,23 +7853,108 @@ struct BrowserWindow {
                     app->remove_bookmark(uri);
                     term_print("Marcador eliminado: " + uri);
                 } else {
-                    app->add_bookmark(uri, title_c ? title_c : uri);
-                    term_print("Marcador guardado: " + std::string(title_c ? title_c : uri));
+                    switch (app->add_bookmark(uri, title_c ? title_c : uri)) {
+                    case PrekTBR::BookmarkAdd::Added:
+                        term_print("Marcador guardado: " + std::string(title_c ? title_c : uri));
+                        break;
+                    case PrekTBR::BookmarkAdd::Pending:
+                        term_print("Marcador pendiente (los datos cifrados aún se están cargando): " + uri);
+                        break;
+                    case PrekTBR::BookmarkAdd::Rejected:
+                        term_print("No se pudo guardar el marcador: " + uri);
+                        break;
+                    }
                 }
                 gtk_button_set_label(GTK_BUTTON(bookmark_star), "★");
             }
+        } else if ((cmd == "bookmarks" || cmd == "history" || cmd == "bmfolder" ||
+                    cmd == "bmtag" || cmd == "importbookmarks" || cmd == "search") &&
+                   !app->store_ready) {
+            term_print("Los datos cifrados aún se están cargando, prueba en un momento.");
         } else if (cmd == "bookmarks") {
             if (app->bookmarks.empty()) {
                 term_print("Sin marcadores guardados.");
             } else {
-                term_print("Marcadores guardados:");
+                // Filtro opcional: "#etiqueta" o prefijo de carpeta
+                std::string tag    = (!args.empty() && args[0] == '#') ? args.substr(1) : "";
+                std::string folder = (!args.empty() && args[0] != '#') ? args : "";
+                term_print(args.empty() ? "Marcadores guardados:" : "Marcadores en " + args + ":");
                 int i = 1;
-                for (auto& b : app->bookmarks) {
+                app->bookmarks.for_each([&](const BookmarkStore::Bookmark& b){
+                    if (!tag.empty() && std::find(b.tags.begin(), b.tags.end(), tag) == b.tags.end())
+                        return;
+                    if (!folder.empty() && b.folder.compare(0, folder.size(), folder) != 0)
+                        return;
                     char buf[32];
                     snprintf(buf, sizeof(buf), "  %3d.", i++);
-                    term_print(std::string(buf) + " " + b.value("title","") +
-                               "\n       " + b.value("url",""));
+                    std::string line = std::string(buf) + " " + b.title;
+                    if (!b.folder.empty()) line += "  [" + b.folder + "]";
+                    for (auto& t : b.tags) line += " #" + t;
+                    term_print(line + "\n       " + b.url);
+                });
+                if (i == 1) term_print("  (ninguno)");
+            }
+        } else if (cmd == "bmfolder" || cmd == "bmtag") {
+            const char* uri_c = webkit_web_view_get_uri(wv());
+            if (!uri_c || !app->is_bookmarked(uri_c)) {
+                term_print("La página actual no está en marcadores.");
+            } else if (cmd == "bmfolder") {
+                app->update_bookmark(uri_c, &args, nullptr);
+                term_print(args.empty() ? "Marcador movido a la raíz." : "Marcador movido a " + args);
+            } else {
+                std::vector<std::string> tags;
+                std::istringstream ts(args);
+                std::string t;
+                while (ts >> t) {
+                    if (t[0] == '#') t = t.substr(1);
+                    if (!t.empty()) tags.push_back(t);
+                }
+                app->update_bookmark(uri_c, nullptr, &tags);
+                term_print(tags.empty() ? "Etiquetas eliminadas." : "Etiquetas actualizadas.");
+            }
+        } else if (cmd == "importbookmarks") {
+            if (args.empty()) {
+                term_print("Uso: importbookmarks <archivo.html>");
+            } else {
+                std::string path = args;
+                if (path[0] == '~') {
+                    const char* home = getenv("HOME");
+                    path = std::string(home ? home : "") + path.substr(1);
                 }
+                term_print("Importando " + path + "…");
+                BrowserWindow* self = this;
+                std::thread([self, path](){
+                    auto t0 = std::chrono::steady_clock::now();
+                    auto* imp = new NetscapeImporter();
+                    bool ok = imp->import_file(path);
+                    double ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - t0).count();
+                    using ImportResult = std::tuple<BrowserWindow*, NetscapeImporter*, bool, double>;
+                    g_idle_add([](gpointer d) -> gboolean {
+                        auto* r = static_cast<ImportResult*>(d);
+                        BrowserWindow* w = std::get<0>(*r);
+                        NetscapeImporter* imp = std::get<1>(*r);
+                        if (!std::get<2>(*r)) {
+                            w->term_print("Error: no se pudo leer el archivo.");
+                        } else if (!w->app->store_ready) {
+                            w->term_print("Los datos cifrados aún se están cargando, prueba en un momento.");
+                        } else {
+                            size_t found = imp->out.size();
+                            size_t added = w->app->import_bookmarks(imp->out);
+                            char buf[160];
+                            snprintf(buf, sizeof(buf), "%zu marcadores leídos en %.0f ms, %zu nuevos.",
+                                     found, std::get<3>(*r), added);
+                            w->term_print(buf);
+                            w->update_bookmark_star();
+                        }
+                        w->term_print("");
+                        w->term_prompt();
+                        delete imp;
+                        delete r;
+                        return G_SOURCE_REMOVE;
+                    }, new ImportResult(self, imp, ok, ms));
+                }).detach();
+                return;
             }
         } else if (cmd == "history") {
             int n = 10;
@@ -2685,19 +7967,38 @@ struct BrowserWindow {
                 char buf[64];
                 snprintf(buf, sizeof(buf), "Últimas %d páginas:", n);
                 term_print(buf);
-                int start = std::max(0, (int)app->history.size() - n);
-                std::vector<json> slice(app->history.begin() + start, app->history.end());
-                std::reverse(slice.begin(), slice.end());
-                int i = 1;
-                for (auto& h : slice) {
-                    std::string ts = h.value("ts","");
-                    if (ts.size() > 19) ts = ts.substr(0,19);
-                    // Reemplazar T por espacio
-                    for (char& c : ts) if (c=='T') c=' ';
+                size_t count = std::min<size_t>(app->history.size(), (size_t)std::max(n, 0));
+                for (size_t i = 0; i < count; i++) {
+                    auto h = app->history.recent(i);
                     char lb[32];
-                    snprintf(lb, sizeof(lb), "  %3d.", i++);
-                    term_print(std::string(lb) + " [" + ts + "] " + h.value("title",h.value("url","")) +
-                               "\n       " + h.value("url",""));
+                    snprintf(lb, sizeof(lb), "  %3zu.", i + 1);
+                    std::string line = std::string(lb) + " [" + format_ts(h.ts) + "] ";
+                    line += h.title.empty() ? h.url : h.title;
+                    line += "\n       ";
+                    line += h.url;
+                    term_print(line);
+                }
+            }
+        } else if (cmd == "search") {
+            if (args.empty()) {
+                term_print("Uso: search <términos>");
+            } else {
+                auto t0 = std::chrono::steady_clock::now();
+                auto hits = app->search_index.search(args, 20);
+                double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - t0).count();
+                char buf[96];
+                snprintf(buf, sizeof(buf), "%zu resultados en %.2f ms (%zu páginas indexadas):",
+                         hits.size(), ms, app->search_index.size());
+                term_print(buf);
+                int i = 1;
+                for (auto& h : hits) {
+                    const auto& d = app->search_index.doc(h.doc);
+                    snprintf(buf, sizeof(buf), "  %3d.", i++);
+                    std::string line = std::string(buf) + (d.bookmarked ? " ★ " : " ") + d.title;
+                    if (d.visits) line += "  (" + std::to_string(d.visits) + " visitas, " +
+                                          format_ts(d.last_ts, "%Y-%m-%d") + ")";
+                    term_print(line + "\n       " + d.url);
                 }
             }
         } else if (cmd == "dark") {
@@ -2753,7 +8054,7 @@ struct BrowserWindow {
                 "  [*] Geolocation: bloqueada silenciosamente\n"
                 "  [*] MediaDevices: cámaras/micrófonos ocultos\n"
                 "  [*] SpeechSynthesis/Recognition: bloqueados\n"
-                "  [*] Cookies: limpieza automática al cerrar pestaña\n"
+                "  [*] Cookies: limpieza de los sitios de la pestaña al cerrarla\n"
                 "  [*] JS popups y autoplay: bloqueados\n"
                 "  [*] Esquemas peligrosos bloqueados (js:, data:, blob:)\n"
                 "  [*] calc: evaluador AST seguro\n"
@@ -2763,9 +8064,9 @@ struct BrowserWindow {
             );
         } else if (cmd == "clearcookies") {
             clear_tab_data(td());
-            term_print("Cookies y datos de sesión de la pestaña actual eliminados.");
+            term_print("Cookies y datos de los sitios de la pestaña actual eliminados.");
         } else if (cmd == "clearall") {
-            for (auto& t : tabs) clear_tab_data(t);
+            for (auto& t : tabs) wipe_tab_data(*t);
             term_print("Datos de todas las pestañas eliminados.");
         } else if (cmd == "quit" || cmd == "exit") {
             g_application_quit(G_APPLICATION(app->app));
@@ -2789,6 +8090,8 @@ static void on_activate(GtkApplication* gapp, gpointer) {
 
     auto* bwin = new BrowserWindow();
     bwin->app  = g_prektbr;
+    g_prektbr->on_store_ready.push_back([bwin]{ bwin->on_store_ready(); });
+    g_prektbr->on_store_change.push_back([bwin](const PrekTBR::StoreChange& c){ bwin->on_store_change(c); });
 
     bwin->window = GTK_APPLICATION_WINDOW(
         gtk_application_window_new(gapp));
@@ -2797,7 +8100,12 @@ static void on_activate(GtkApplication* gapp, gpointer) {
 
     bwin->build_ui();
     bwin->open_tab(g_prektbr->initial_url);
+    if (g_prektbr->store_ready) bwin->restore_session();
     gtk_window_present(GTK_WINDOW(bwin->window));
+    if (g_startup.window_ms < 0) {
+        g_startup.window_ms = g_startup.since_start();
+        g_startup.report();
+    }
 }
 
 static void on_open(GtkApplication* gapp, GFile** files, gint n_files,
@@ -2818,15 +8126,35 @@ static void on_open(GtkApplication* gapp, GFile** files, gint n_files,
 }
 
 int main(int argc, char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench-codec") == 0)
+        return run_codec_benchmark();
+    if (argc > 1 && strcmp(argv[1], "--compile-hosts") == 0)
+        return run_compile_hosts(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--probe-proxy") == 0)
+        return run_probe_proxy(argc, argv);
+
+    // Opciones propias: se quitan de argv antes de pasarlo a GApplication
+    int out_argc = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--startup-stats") == 0) g_startup.enabled = true;
+        else argv[out_argc++] = argv[i];
+    }
+    argc = out_argc;
+    argv[argc] = nullptr;
+
     // Configurar variables de entorno
     setenv("GDK_DEBUG", "portals", 0);
     setenv("GTK_A11Y", "none", 0);
 
     // Inicializar rutas y clave
     init_data_paths();
-    g_key = derive_key();
+    load_config();
+    g_persist.start(cfg("persist_window_ms", 250));
 
+    // La clave y el almacén se cargan en segundo plano: la ventana y la
+    // primera pestaña no esperan al PBKDF2.
     g_prektbr = new PrekTBR();
+    g_prektbr->start_loading();
 
     GtkApplication* gapp = gtk_application_new(
         "com.cinnamolhyia.prektbr",
@@ -2850,10 +8178,21 @@ int main(int argc, char* argv[]) {
         }
     }), provider);
 
-    // SIGINT → quit
-    signal(SIGINT, [](int){ if (g_prektbr && g_prektbr->app) g_application_quit(G_APPLICATION(g_prektbr->app)); });
+    // SIGINT → quit (desde el bucle principal, no desde el manejador de señal)
+    g_unix_signal_add(SIGINT, [](gpointer) -> gboolean {
+        if (g_prektbr && g_prektbr->app) g_application_quit(G_APPLICATION(g_prektbr->app));
+        return G_SOURCE_REMOVE;
+    }, nullptr);
+    // Al salir se vacía la cola sin esperar la ventana de agrupación
+    g_signal_connect(gapp, "shutdown", G_CALLBACK(+[](GApplication*, gpointer){
+        g_prektbr->wait_ready();
+        g_prektbr->save_search_index();
+        g_persist.flush();
+    }), nullptr);
 
     int status = g_application_run(G_APPLICATION(gapp), argc, argv);
+    g_prektbr->wait_ready();
+    g_persist.stop();
 
     g_object_unref(gapp);
     delete g_prektbr;